@@ -0,0 +1,445 @@
+#include "analyzer.h"
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "chip8.h"
+#include "cpu.h"
+#include "instruction.h"
+#include "quirks.h"
+
+namespace {
+// How an instruction passes control on.
+enum class Flow {
+  NEXT, // to the following instruction
+  SKIP, // to the following instruction or the one after it
+  JUMP, // to NNN
+  CALL, // to NNN, later returning to the following instruction
+  RETURN, // to the return address on the stack
+  INDIRECT, // to an address computed at runtime
+  INVALID // nowhere, the opcode does not exist
+};
+
+Flow flow(const Instruction& ins) {
+  if (ins.handler == &CPU::op_unknown) {
+    return Flow::INVALID;
+  }
+  switch (ins.opcode & 0xF000) {
+    case 0x0000:
+      if (ins.opcode == 0x00E0) {
+        return Flow::NEXT;
+      }
+      // 0NNN is executed as a call by this interpreter.
+      return ins.opcode == 0x00EE ? Flow::RETURN : Flow::CALL;
+    case 0x1000: return Flow::JUMP;
+    case 0x2000: return Flow::CALL;
+    case 0x3000:
+    case 0x4000:
+    case 0x5000:
+    case 0x9000:
+    case 0xE000: return Flow::SKIP;
+    case 0xB000: return Flow::INDIRECT;
+    default: return Flow::NEXT;
+  }
+}
+
+std::string hex(unsigned value, int digits) {
+  static const char* const DIGITS {"0123456789ABCDEF"};
+  std::string text(static_cast<std::size_t>(digits), '0');
+  for (int digit {digits - 1}; digit >= 0; --digit, value >>= 4) {
+    text[static_cast<std::size_t>(digit)] = DIGITS[value & 0xF];
+  }
+  return text;
+}
+
+std::string reg(unsigned idx) {
+  return "V" + hex(idx, 1);
+}
+
+// Whether BNNN adds VX rather than V0 under the profile, see quirks.h.
+bool jump_adds_vx(QuirkProfile profile) {
+  switch (profile) {
+    case QuirkProfile::CHIP48: return Chip48Quirks::JUMP_ADDS_VX;
+    case QuirkProfile::SUPER_CHIP: return SuperChipQuirks::JUMP_ADDS_VX;
+    case QuirkProfile::CHIP8: break;
+  }
+  return Chip8Quirks::JUMP_ADDS_VX;
+}
+
+/*
+ * Describes the instruction with the wording of misc/ops.txt, the operands
+ * filled in, as the profile executes it. Each element is one line of the
+ * description.
+ */
+std::vector<std::string> describe(const Instruction& ins,
+                                  QuirkProfile profile) {
+  const std::string X {reg(ins.X)};
+  const std::string Y {reg(ins.Y)};
+  const std::string NN {hex(ins.NN, 2)};
+  const std::string NNN {hex(ins.NNN, 3)};
+  switch (ins.opcode & 0xF000) {
+    case 0x0000:
+      switch (ins.opcode) {
+        case 0x00E0: return {"Clear the screen"};
+        case 0x00EE: return {"Return from a subroutine"};
+        default:
+          return {"Execute machine language subroutine at address " + NNN};
+      }
+    case 0x1000: return {"Jump to address " + NNN};
+    case 0x2000: return {"Execute subroutine starting at address " + NNN};
+    case 0x3000:
+      return {"Skip the following instruction if the value of register " + X
+              + " equals " + NN};
+    case 0x4000:
+      return {"Skip the following instruction if the value of register " + X
+                + " is not",
+              "equal to " + NN};
+    case 0x5000:
+      return {"Skip the following instruction if the value of register " + X
+                + " is equal",
+              "to the value of register " + Y};
+    case 0x6000: return {"Store number " + NN + " in register " + X};
+    case 0x7000: return {"Add the value " + NN + " to register " + X};
+    case 0x8000:
+      switch (ins.opcode & 0x000F) {
+        case 0x0:
+          return {"Store the value of register " + Y + " in register " + X};
+        case 0x1: return {"Set " + X + " to " + X + " OR " + Y};
+        case 0x2: return {"Set " + X + " to " + X + " AND " + Y};
+        case 0x3: return {"Set " + X + " to " + X + " XOR " + Y};
+        case 0x4:
+          return {"Add the value of register " + Y + " to register " + X,
+                  "Set VF to 01 if a carry occurs",
+                  "Set VF to 00 if a carry does not occur"};
+        case 0x5:
+          return {"Subtract the value of register " + Y + " from register "
+                    + X,
+                  "Set VF to 00 if a borrow occurs",
+                  "Set VF to 01 if a borrow does not occur"};
+        case 0x6:
+          return {"Store the value of register " + Y
+                    + " shifted right one bit in register " + X,
+                  "Set register VF to the least significant bit prior to "
+                  "the shift"};
+        case 0x7:
+          return {"Set register " + X + " to the value of " + Y + " minus "
+                    + X,
+                  "Set VF to 00 if a borrow occurs",
+                  "Set VF to 01 if a borrow does not occur"};
+        case 0xE:
+          return {"Store the value of register " + Y
+                    + " shifted left one bit in register " + X,
+                  "Set register VF to the most significant bit prior to "
+                  "the shift"};
+      }
+      break;
+    case 0x9000:
+      return {"Skip the following instruction if the value of register " + X
+                + " is not",
+              "equal to the value of register " + Y};
+    case 0xA000: return {"Store memory address " + NNN + " in register I"};
+    case 0xB000:
+      return {"Jump to address " + NNN + " + "
+              + (jump_adds_vx(profile) ? X : reg(0))};
+    case 0xC000:
+      return {"Set " + X + " to a random number with a mask of " + NN};
+    case 0xD000:
+      return {"Draw a sprite at position " + X + ", " + Y + " with "
+                + std::to_string(ins.N) + " bytes of sprite data",
+              "starting at the address stored in I",
+              "Set VF to 01 if any set pixels are changed to unset, and 00 "
+              "otherwise"};
+    case 0xE000:
+      switch (ins.opcode & 0x00FF) {
+        case 0x9E:
+          return {"Skip the following instruction if the key corresponding "
+                  "to the",
+                  "hex value currently stored in register " + X
+                    + " is pressed"};
+        case 0xA1:
+          return {"Skip the following instruction if the key corresponding "
+                  "to the",
+                  "hex value currently stored in register " + X
+                    + " is not pressed"};
+      }
+      break;
+    case 0xF000:
+      switch (ins.opcode & 0x00FF) {
+        case 0x07:
+          return {"Store the current value of the delay timer in register "
+                  + X};
+        case 0x0A:
+          return {"Wait for a keypress and store the result in register "
+                  + X};
+        case 0x15:
+          return {"Set the delay timer to the value of register " + X};
+        case 0x18:
+          return {"Set the sound timer to the value of register " + X};
+        case 0x1E:
+          return {"Add the value stored in register " + X + " to register I"};
+        case 0x29:
+          return {"Set I to the memory address of the sprite data "
+                  "corresponding to the",
+                  "hexadecimal digit stored in register " + X};
+        case 0x33:
+          return {"Store the binary-coded decimal equivalent of the value "
+                  "stored in",
+                  "register " + X + " at addresses I, I+1, and I+2"};
+        case 0x55:
+          return {"Store the values of registers V0 to " + X
+                    + " inclusive in memory starting",
+                  "at address I",
+                  "I is set to I + " + hex(ins.X, 1) + " + 1 after operation"};
+        case 0x65:
+          return {"Fill registers V0 to " + X
+                    + " inclusive with the values stored in memory",
+                  "starting at address I",
+                  "I is set to I + " + hex(ins.X, 1) + " + 1 after operation"};
+      }
+      break;
+  }
+  return {"Unknown operation"};
+}
+
+bool in_program(std::uint32_t address) {
+  return address >= 0x200 && address <= 0xFFE;
+}
+} // namespace
+
+Analysis::Analysis(const CHIP8& chip8)
+  : bytes {}, blocks {}, subroutines {}, indirect_jumps {}, problems {} {
+  bytes.fill(Byte::UNKNOWN);
+  std::bitset<0x1000> instructions {};
+  std::bitset<0x1000> leaders {};
+  std::vector<std::uint16_t> pending {0x200};
+  leaders.set(0x200);
+  // Queues a branch target, or records why it cannot be followed.
+  const auto follow = [&](std::uint16_t from, std::uint32_t target) {
+    if (!in_program(target)) {
+      problems.push_back("Control leaves the program area at " + hex(from, 3)
+                         + " towards " + hex(target, 3) + ".");
+      return;
+    }
+    if (!leaders.test(target)) {
+      leaders.set(target);
+      pending.push_back(static_cast<std::uint16_t>(target));
+    }
+  };
+
+  // Walk every path once, a path ends where the control flow branches.
+  while (!pending.empty()) {
+    std::uint16_t address {pending.back()};
+    pending.pop_back();
+    while (!instructions.test(address)) {
+      instructions.set(address);
+      bytes[address] = Byte::CODE;
+      bytes[address + 1] = Byte::CODE;
+      const Instruction ins {
+        CPU::decode(chip8.fetch(address), chip8.quirks)};
+      const std::uint32_t next {address + 2u};
+      const Flow kind {flow(ins)};
+      if (kind == Flow::NEXT) {
+        if (!in_program(next)) {
+          problems.push_back("Execution runs past the end of memory at "
+                             + hex(address, 3) + ".");
+          break;
+        }
+        address = static_cast<std::uint16_t>(next);
+        continue;
+      }
+      switch (kind) {
+        case Flow::SKIP:
+          follow(address, next);
+          follow(address, next + 2);
+          break;
+        case Flow::JUMP:
+          follow(address, ins.NNN);
+          break;
+        case Flow::CALL:
+          subroutines.push_back(ins.NNN);
+          follow(address, ins.NNN);
+          follow(address, next);
+          break;
+        case Flow::INDIRECT:
+          indirect_jumps.push_back(address);
+          break;
+        case Flow::INVALID:
+          problems.push_back("Unknown opcode " + hex(ins.opcode, 4) + " at "
+                             + hex(address, 3) + ".");
+          break;
+        default:
+          break;
+      }
+      break;
+    }
+  }
+  std::sort(subroutines.begin(), subroutines.end());
+  subroutines.erase(std::unique(subroutines.begin(), subroutines.end()),
+                    subroutines.end());
+  std::sort(indirect_jumps.begin(), indirect_jumps.end());
+
+  // Split the reachable code into basic blocks and classify the bytes each
+  // block references through I.
+  for (std::uint32_t start {0x200}; start < 0x1000; ++start) {
+    if (!leaders.test(start) || !instructions.test(start)) {
+      continue;
+    }
+    Block block {static_cast<std::uint16_t>(start), 0, {}};
+    std::uint32_t address {start};
+    bool index_known {false};
+    std::uint16_t index {0};
+    const auto mark = [&](std::size_t length, Byte kind) {
+      for (std::size_t offset {0}; offset < length; ++offset) {
+        Byte& byte {bytes[(index + offset) & 0xFFF]};
+        if (byte != Byte::CODE) {
+          byte = kind;
+        }
+      }
+    };
+    while (true) {
+      const Instruction ins {CPU::decode(
+        chip8.fetch(static_cast<std::uint16_t>(address)), chip8.quirks)};
+      const std::uint32_t next {address + 2};
+      switch (ins.opcode & 0xF0FF) {
+        case 0xF033:
+          if (index_known) {
+            mark(3, Byte::DATA);
+          }
+          break;
+        case 0xF055:
+        case 0xF065:
+          if (index_known) {
+            mark(ins.X + 1u, Byte::DATA);
+          }
+          index_known = false;
+          break;
+        case 0xF01E:
+        case 0xF029:
+          index_known = false;
+          break;
+        default:
+          if ((ins.opcode & 0xF000) == 0xA000) {
+            index = ins.NNN;
+            index_known = true;
+          } else if ((ins.opcode & 0xF000) == 0xD000 && index_known) {
+            mark(ins.N, Byte::SPRITE);
+          }
+          break;
+      }
+      const Flow kind {flow(ins)};
+      if (kind == Flow::NEXT && in_program(next) && !leaders.test(next)) {
+        address = next;
+        continue;
+      }
+      block.end = static_cast<std::uint16_t>(next);
+      switch (kind) {
+        case Flow::NEXT:
+          if (in_program(next)) {
+            block.successors.push_back(static_cast<std::uint16_t>(next));
+          }
+          break;
+        case Flow::SKIP:
+          block.successors.push_back(static_cast<std::uint16_t>(next));
+          block.successors.push_back(static_cast<std::uint16_t>(next + 2));
+          break;
+        case Flow::JUMP:
+          block.successors.push_back(ins.NNN);
+          break;
+        case Flow::CALL:
+          block.successors.push_back(ins.NNN);
+          block.successors.push_back(static_cast<std::uint16_t>(next));
+          break;
+        default:
+          break;
+      }
+      break;
+    }
+    blocks.push_back(block);
+  }
+}
+
+void Analysis::write_listing(const CHIP8& chip8, std::ostream& out) const {
+  std::uint32_t end {0x1000};
+  while (end > 0x200 && bytes[end - 1] == Byte::UNKNOWN
+         && chip8.mem[end - 1] == 0) {
+    --end;
+  }
+  std::size_t block_idx {0};
+  std::uint32_t address {0x200};
+  while (address < end) {
+    while (block_idx < blocks.size() && blocks[block_idx].end <= address) {
+      ++block_idx;
+    }
+    const bool in_block {block_idx < blocks.size()
+                         && blocks[block_idx].start <= address};
+    if (in_block && blocks[block_idx].start == address) {
+      const bool subroutine {std::binary_search(
+        subroutines.begin(), subroutines.end(), address)};
+      out << '\n'
+          << (address == 0x200 ? "main" : subroutine ? "sub_" : "loc_")
+          << (address == 0x200 ? "" : hex(address, 3)) << ":\n";
+    }
+    if (in_block) {
+      const Instruction ins {CPU::decode(
+        chip8.fetch(static_cast<std::uint16_t>(address)), chip8.quirks)};
+      const std::vector<std::string> lines {describe(ins, chip8.quirks)};
+      out << hex(address, 3) << "  " << hex(ins.opcode, 4) << "\t    "
+          << lines[0];
+      if (std::binary_search(indirect_jumps.begin(), indirect_jumps.end(),
+                             address)) {
+        out << "  (indirect, target unknown)";
+      }
+      out << '\n';
+      for (std::size_t line {1}; line < lines.size(); ++line) {
+        out << "                 " << lines[line] << '\n';
+      }
+      address += 2;
+      continue;
+    }
+    if (bytes[address] == Byte::SPRITE) {
+      // One sprite row per line, drawn the way DXYN would.
+      std::string pixels {};
+      for (int bit {7}; bit >= 0; --bit) {
+        pixels += (chip8.mem[address] >> bit) & 1 ? '#' : '.';
+      }
+      out << hex(address, 3) << "  " << hex(chip8.mem[address], 2)
+          << "  \t    sprite " << pixels << '\n';
+      ++address;
+      continue;
+    }
+    // Data and unreached bytes, up to 8 per line.
+    const Byte kind {bytes[address]};
+    out << hex(address, 3) << "  ";
+    std::string values {};
+    for (std::size_t count {0}; count < 8 && address < end
+         && bytes[address] == kind; ++count, ++address) {
+      values += (count ? " " : "") + hex(chip8.mem[address], 2);
+    }
+    out << values << "\t    "
+        << (kind == Byte::DATA ? "data" : kind == Byte::CODE
+            ? "overlapping code" : "unreached") << '\n';
+  }
+  for (const std::string& problem : problems) {
+    out << "; " << problem << '\n';
+  }
+}
+
+void Analysis::warm_up(CHIP8& chip8) const {
+  for (const Block& block : blocks) {
+    for (std::uint32_t address {block.start}; address < block.end;
+         address += 2) {
+      chip8.icache[address - 0x200] =
+        CPU::decode(chip8.fetch(static_cast<std::uint16_t>(address)),
+                    chip8.quirks);
+    }
+    if (chip8.mode == ExecutionMode::BLOCKS) {
+      chip8.translator.warm(chip8, block.start);
+    }
+  }
+}
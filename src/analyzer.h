@@ -0,0 +1,58 @@
+#ifndef ANALYZER_H
+#define ANALYZER_H
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class CHIP8;
+
+/*
+ * Static analysis of the program in memory. Starting at 0x200, it follows
+ * jumps, calls, returns and skips to find every reachable instruction and
+ * splits them into basic blocks. Bytes that reachable instructions use as
+ * sprites or as FX33/FX55/FX65 operands, through an I set by a preceding ANNN
+ * in the same block, are classified as data. BNNN jumps cannot be followed
+ * and are only recorded.
+ *
+ * Self-modifying programs may execute code the analysis never sees; the
+ * results are a starting point for the predecoder, not a guarantee.
+ */
+class Analysis {
+public:
+  enum class Byte : std::uint8_t {
+    UNKNOWN, // never reached nor referenced
+    CODE, // part of a reachable instruction
+    SPRITE, // drawn by DXYN
+    DATA // read or written by FX33, FX55 or FX65
+  };
+
+  struct Block {
+    std::uint16_t start;
+    std::uint16_t end; // address following the last instruction
+    std::vector<std::uint16_t> successors;
+  };
+
+public:
+  explicit Analysis(const CHIP8& chip8);
+  // Writes a listing of memory from 0x200 in the format of misc/ops.txt,
+  // prefixed by the address. Subroutines and jump targets are labelled,
+  // data is dumped as bytes.
+  void write_listing(const CHIP8& chip8, std::ostream& out) const;
+  // Predecodes every reachable instruction and translates the blocks that
+  // start at basic block boundaries, so that neither happens during the run.
+  void warm_up(CHIP8& chip8) const;
+
+public:
+  std::array<Byte, 0x1000> bytes;
+  std::vector<Block> blocks; // sorted by start address
+  std::vector<std::uint16_t> subroutines; // 2NNN targets, sorted
+  std::vector<std::uint16_t> indirect_jumps; // addresses of BNNN
+  // Reasons to believe the ROM is broken, e.g. a reachable opcode that does
+  // not exist or a jump out of the program area. Empty for a sound ROM.
+  std::vector<std::string> problems;
+};
+
+#endif // ANALYZER_H
@@ -0,0 +1,77 @@
+#include "arena.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include "chip8.h"
+#include "rom.h"
+
+constexpr std::size_t MachineArena::CACHE_LINE;
+constexpr std::size_t MachineArena::SLOT_SIZE;
+
+namespace {
+unsigned char* align_to_line(void* storage) {
+  const std::uintptr_t address {reinterpret_cast<std::uintptr_t>(storage)};
+  const std::uintptr_t line {MachineArena::CACHE_LINE};
+  return reinterpret_cast<unsigned char*>((address + line - 1) / line * line);
+}
+} // namespace
+
+MachineArena::MachineArena(std::size_t capacity)
+  : owned {new unsigned char[bytes_for(capacity)]},
+    slots {::align_to_line(owned.get())}, slot_count {capacity},
+    constructed {0}, released {} {
+  released.reserve(slot_count);
+}
+
+MachineArena::MachineArena(void* storage, std::size_t bytes)
+  : owned {}, slots {::align_to_line(storage)},
+    slot_count {bytes < bytes_for(1)
+                ? 0 : (bytes - (CACHE_LINE - 1)) / SLOT_SIZE},
+    constructed {0}, released {} {
+  if (slot_count == 0) {
+    throw std::invalid_argument("The storage cannot hold a single machine.");
+  }
+  released.reserve(slot_count);
+}
+
+MachineArena::~MachineArena() {
+  for (std::size_t slot {0}; slot < constructed; ++slot) {
+    reinterpret_cast<CHIP8*>(slots + slot * SLOT_SIZE)->~CHIP8();
+  }
+}
+
+/**
+ * Machines are constructed in slot order and never destroyed before the
+ * arena is, so the slots up to constructed always hold one.
+ */
+CHIP8* MachineArena::acquire(const RomImage& rom) {
+  if (!released.empty()) {
+    CHIP8* chip8 {released.back()};
+    released.pop_back();
+    chip8->reset(rom);
+    return chip8;
+  }
+  if (constructed == slot_count) {
+    throw std::runtime_error("Every machine of the arena is in use.");
+  }
+  CHIP8* chip8 {new (slots + constructed * SLOT_SIZE) CHIP8 {rom}};
+  ++constructed;
+  return chip8;
+}
+
+void MachineArena::release(CHIP8* chip8) {
+  released.push_back(chip8);
+}
+
+std::size_t MachineArena::capacity() const {
+  return slot_count;
+}
+
+std::size_t MachineArena::in_use() const {
+  return constructed - released.size();
+}
@@ -0,0 +1,59 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "chip8.h"
+#include "rom.h"
+
+/*
+ * Fixed storage for up to a given number of CHIP8 instances, allocated once
+ * up front or supplied by the caller. Machines are constructed in place in
+ * slots aligned to a cache line, so the hot registers at the start of each
+ * machine share a single line. Released machines stay constructed and are
+ * handed out again through CHIP8::reset, so recycling a machine neither
+ * allocates nor frees memory.
+ */
+class MachineArena {
+public:
+  static constexpr std::size_t CACHE_LINE {64};
+  // Distance between two machines, a multiple of the cache line.
+  static constexpr std::size_t SLOT_SIZE {
+    (sizeof(CHIP8) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE};
+
+public:
+  // Bytes of caller storage needed for capacity machines, whatever its
+  // alignment.
+  static constexpr std::size_t bytes_for(std::size_t capacity) {
+    return capacity * SLOT_SIZE + CACHE_LINE - 1;
+  }
+
+  // Allocates storage for capacity machines.
+  explicit MachineArena(std::size_t capacity);
+  // Uses storage owned by the caller, which must outlive the arena. Throws
+  // std::invalid_argument if it cannot hold a single machine.
+  MachineArena(void* storage, std::size_t bytes);
+  MachineArena(const MachineArena&) = delete;
+  MachineArena& operator=(const MachineArena&) = delete;
+  // Destroys every machine constructed in the arena, released or not.
+  ~MachineArena();
+  // Returns a machine with rom freshly loaded, reusing a released machine if
+  // there is one. Throws std::runtime_error if every slot is in use.
+  CHIP8* acquire(const RomImage& rom);
+  // Hands the machine back for reuse by acquire.
+  void release(CHIP8* chip8);
+  std::size_t capacity() const;
+  // Number of machines acquired and not yet released.
+  std::size_t in_use() const;
+
+private:
+  std::unique_ptr<unsigned char[]> owned;
+  unsigned char* slots; // first slot, aligned to a cache line
+  std::size_t slot_count;
+  std::size_t constructed; // slots before this one hold a machine
+  std::vector<CHIP8*> released; // reserved for every slot up front
+};
+
+#endif // ARENA_H
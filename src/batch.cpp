@@ -0,0 +1,447 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "chip8.h"
+#include "cpu.h"
+#include "instruction.h"
+#include "rom.h"
+
+namespace {
+// Element-wise operations on a row of registers, dst = dst OP src.
+enum class LaneOp { MOV, OR, AND, XOR, ADD };
+
+template <LaneOp Op>
+std::uint8_t combine(std::uint8_t a, std::uint8_t b) {
+  switch (Op) {
+    case LaneOp::MOV: return b;
+    case LaneOp::OR: return a | b;
+    case LaneOp::AND: return a & b;
+    case LaneOp::XOR: return a ^ b;
+    case LaneOp::ADD: return static_cast<std::uint8_t>(a + b);
+  }
+  return b;
+}
+
+#if defined(__SSE2__)
+template <LaneOp Op>
+__m128i combine(__m128i a, __m128i b) {
+  switch (Op) {
+    case LaneOp::MOV: return b;
+    case LaneOp::OR: return _mm_or_si128(a, b);
+    case LaneOp::AND: return _mm_and_si128(a, b);
+    case LaneOp::XOR: return _mm_xor_si128(a, b);
+    case LaneOp::ADD: return _mm_add_epi8(a, b);
+  }
+  return b;
+}
+#endif
+
+#if defined(__AVX2__)
+template <LaneOp Op>
+__m256i combine(__m256i a, __m256i b) {
+  switch (Op) {
+    case LaneOp::MOV: return b;
+    case LaneOp::OR: return _mm256_or_si256(a, b);
+    case LaneOp::AND: return _mm256_and_si256(a, b);
+    case LaneOp::XOR: return _mm256_xor_si256(a, b);
+    case LaneOp::ADD: return _mm256_add_epi8(a, b);
+  }
+  return b;
+}
+#endif
+
+template <LaneOp Op, std::size_t Lanes>
+void apply(std::uint8_t* dst, const std::uint8_t* src) {
+  std::size_t idx {0};
+#if defined(__AVX2__)
+  for (; idx + 32 <= Lanes; idx += 32) {
+    __m256i* out {reinterpret_cast<__m256i*>(dst + idx)};
+    const __m256i b {
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + idx))};
+    _mm256_storeu_si256(out, combine<Op>(_mm256_loadu_si256(out), b));
+  }
+#endif
+#if defined(__SSE2__)
+  for (; idx + 16 <= Lanes; idx += 16) {
+    __m128i* out {reinterpret_cast<__m128i*>(dst + idx)};
+    const __m128i b {
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + idx))};
+    _mm_storeu_si128(out, combine<Op>(_mm_loadu_si128(out), b));
+  }
+#endif
+  for (; idx < Lanes; ++idx) {
+    dst[idx] = combine<Op>(dst[idx], src[idx]);
+  }
+}
+
+// flags = 1 where x + y overflows a byte, 0 otherwise. May alias x or y.
+template <std::size_t Lanes>
+void carry(std::uint8_t* flags, const std::uint8_t* x, const std::uint8_t* y) {
+  std::size_t idx {0};
+#if defined(__AVX2__)
+  for (; idx + 32 <= Lanes; idx += 32) {
+    const __m256i a {
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + idx))};
+    const __m256i b {
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + idx))};
+    const __m256i sum {_mm256_add_epi8(a, b)};
+    // The sum wrapped around exactly if it is smaller than an operand.
+    const __m256i no_carry {_mm256_cmpeq_epi8(_mm256_max_epu8(sum, a), sum)};
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(flags + idx),
+                        _mm256_andnot_si256(no_carry, _mm256_set1_epi8(1)));
+  }
+#endif
+#if defined(__SSE2__)
+  for (; idx + 16 <= Lanes; idx += 16) {
+    const __m128i a {
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + idx))};
+    const __m128i b {
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + idx))};
+    const __m128i sum {_mm_add_epi8(a, b)};
+    const __m128i no_carry {_mm_cmpeq_epi8(_mm_max_epu8(sum, a), sum)};
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(flags + idx),
+                     _mm_andnot_si128(no_carry, _mm_set1_epi8(1)));
+  }
+#endif
+  for (; idx < Lanes; ++idx) {
+    flags[idx] = x[idx] + y[idx] > 0xFF ? 0x1 : 0x0;
+  }
+}
+
+// Decodes the instruction at address through the lane's instruction cache.
+Instruction decode_at(CHIP8& chip8, std::uint16_t address) {
+  if (address < 0x200) {
+    return CPU::decode(chip8.fetch(address), chip8.quirks);
+  }
+  Instruction& cached {chip8.icache[address - 0x200]};
+  if (!cached.handler) {
+    cached = CPU::decode(chip8.fetch(address), chip8.quirks);
+  }
+  return cached;
+}
+} // namespace
+
+template <std::size_t Lanes>
+constexpr std::size_t LockstepBatch<Lanes>::DIVERGED_SLICE;
+
+template <std::size_t Lanes>
+LockstepBatch<Lanes>::LockstepBatch(const RomImage& rom)
+  : V {}, I {}, pc {}, arena {Lanes}, lanes {}, shared_memory {true},
+    pending_cycles {0}, lockstep_count {0}, scalar_count {0} {
+  for (CHIP8*& chip8 : lanes) {
+    chip8 = arena.acquire(rom);
+  }
+}
+
+template <std::size_t Lanes>
+void LockstepBatch<Lanes>::run(std::size_t cycles) {
+  gather();
+  std::size_t cycle {0};
+  while (cycle < cycles) {
+    if (!together()) {
+      const std::size_t slice {
+        std::min<std::size_t>(DIVERGED_SLICE, cycles - cycle)};
+      run_apart(slice);
+      scalar_count += slice;
+      cycle += slice;
+      continue;
+    }
+    const Instruction ins {
+      decode_at(*lanes[0], static_cast<std::uint16_t>(pc[0] & 0xFFF))};
+    if (step_lockstep(ins)) {
+      ++lockstep_count;
+    } else {
+      step_lanes(ins);
+      ++scalar_count;
+    }
+    // Every step executes one instruction on every lane, so the timers of
+    // all lanes lag behind by the same number of cycles.
+    ++pending_cycles;
+    ++cycle;
+  }
+  scatter();
+}
+
+template <std::size_t Lanes>
+CHIP8& LockstepBatch<Lanes>::lane(std::size_t idx) {
+  return *lanes.at(idx);
+}
+
+template <std::size_t Lanes>
+std::uint64_t LockstepBatch<Lanes>::lockstep_steps() const {
+  return lockstep_count;
+}
+
+template <std::size_t Lanes>
+std::uint64_t LockstepBatch<Lanes>::scalar_steps() const {
+  return scalar_count;
+}
+
+template <std::size_t Lanes>
+void LockstepBatch<Lanes>::gather() {
+  for (std::size_t lane_idx {0}; lane_idx < Lanes; ++lane_idx) {
+    const CHIP8& chip8 {*lanes[lane_idx]};
+    for (std::size_t reg {0}; reg < 16; ++reg) {
+      V[reg][lane_idx] = chip8.V[reg];
+    }
+    I[lane_idx] = chip8.I;
+    pc[lane_idx] = chip8.pc;
+  }
+  // The lanes may have been given different memory contents since.
+  shared_memory = memory_matches(0, 0x1000);
+}
+
+template <std::size_t Lanes>
+void LockstepBatch<Lanes>::scatter() {
+  for (std::size_t lane_idx {0}; lane_idx < Lanes; ++lane_idx) {
+    CHIP8& chip8 {*lanes[lane_idx]};
+    for (std::size_t reg {0}; reg < 16; ++reg) {
+      chip8.V[reg] = V[reg][lane_idx];
+    }
+    chip8.I = I[lane_idx];
+    chip8.pc = pc[lane_idx];
+  }
+  flush_ticks();
+}
+
+template <std::size_t Lanes>
+void LockstepBatch<Lanes>::flush_ticks() {
+  if (pending_cycles) {
+    for (CHIP8* chip8 : lanes) {
+      chip8->tick(pending_cycles);
+    }
+    pending_cycles = 0;
+  }
+}
+
+template <std::size_t Lanes>
+bool LockstepBatch<Lanes>::memory_matches(std::size_t begin,
+                                          std::size_t end) const {
+  const auto first {lanes[0]->mem.begin()};
+  for (std::size_t lane_idx {1}; lane_idx < Lanes; ++lane_idx) {
+    if (!std::equal(first + begin, first + end,
+                    lanes[lane_idx]->mem.begin() + begin)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <std::size_t Lanes>
+bool LockstepBatch<Lanes>::together() const {
+  for (std::size_t lane_idx {1}; lane_idx < Lanes; ++lane_idx) {
+    if (pc[lane_idx] != pc[0]) {
+      return false;
+    }
+  }
+  if (shared_memory) {
+    return true;
+  }
+  // The lanes may have modified their own code differently.
+  const std::uint16_t opcode {lanes[0]->fetch(pc[0])};
+  for (std::size_t lane_idx {1}; lane_idx < Lanes; ++lane_idx) {
+    if (lanes[lane_idx]->fetch(pc[lane_idx]) != opcode) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Executes ins on all lanes at once. Returns false without changing any state
+ * if it has no vector form.
+ */
+template <std::size_t Lanes>
+bool LockstepBatch<Lanes>::step_lockstep(const Instruction& ins) {
+  // Only operations that behave the same under every quirk profile are
+  // executed here. Those touching state other than V, I and pc loop over the
+  // lanes, but never leave the batch.
+  const std::uint16_t address {static_cast<std::uint16_t>(pc[0] & 0xFFF)};
+  std::uint8_t* VX {V[ins.X].data()};
+  const std::uint8_t* VY {V[ins.Y].data()};
+  alignas(32) std::array<std::uint8_t, Lanes> operand {};
+  std::uint16_t next_pc {static_cast<std::uint16_t>(address + 2)};
+  if (ins.handler == &CPU::op_1NNN) {
+    next_pc = ins.NNN;
+  } else if (ins.handler == &CPU::op_3XNN || ins.handler == &CPU::op_4XNN) {
+    const bool skip_if_equal {ins.handler == &CPU::op_3XNN};
+    for (std::size_t lane_idx {0}; lane_idx < Lanes; ++lane_idx) {
+      const bool skip {(VX[lane_idx] == ins.NN) == skip_if_equal};
+      pc[lane_idx] = static_cast<std::uint16_t>(next_pc + (skip ? 2 : 0));
+    }
+    return true;
+  } else if (ins.handler == &CPU::op_5XY0 || ins.handler == &CPU::op_9XY0) {
+    const bool skip_if_equal {ins.handler == &CPU::op_5XY0};
+    for (std::size_t lane_idx {0}; lane_idx < Lanes; ++lane_idx) {
+      const bool skip {(VX[lane_idx] == VY[lane_idx]) == skip_if_equal};
+      pc[lane_idx] = static_cast<std::uint16_t>(next_pc + (skip ? 2 : 0));
+    }
+    return true;
+  } else if (ins.handler == &CPU::op_6XNN) {
+    operand.fill(ins.NN);
+    apply<LaneOp::MOV, Lanes>(VX, operand.data());
+  } else if (ins.handler == &CPU::op_7XNN) {
+    operand.fill(ins.NN);
+    apply<LaneOp::ADD, Lanes>(VX, operand.data());
+  } else if (ins.handler == &CPU::op_8XY0) {
+    apply<LaneOp::MOV, Lanes>(VX, VY);
+  } else if (ins.handler == &CPU::op_8XY1) {
+    apply<LaneOp::OR, Lanes>(VX, VY);
+  } else if (ins.handler == &CPU::op_8XY2) {
+    apply<LaneOp::AND, Lanes>(VX, VY);
+  } else if (ins.handler == &CPU::op_8XY3) {
+    apply<LaneOp::XOR, Lanes>(VX, VY);
+  } else if (ins.handler == &CPU::op_8XY4) {
+    // Same order as the handler: VF is written after VX, which matters when
+    // X or Y is F.
+    carry<Lanes>(operand.data(), VX, VY);
+    apply<LaneOp::ADD, Lanes>(VX, VY);
+    apply<LaneOp::MOV, Lanes>(V[0xF].data(), operand.data());
+  } else if (ins.handler == &CPU::op_ANNN) {
+    I.fill(ins.NNN);
+  } else if (ins.handler == &CPU::op_FX1E) {
+    for (std::size_t lane_idx {0}; lane_idx < Lanes; ++lane_idx) {
+      I[lane_idx] += VX[lane_idx];
+    }
+  } else if (ins.handler == &CPU::op_FX29) {
+    for (std::size_t lane_idx {0}; lane_idx < Lanes; ++lane_idx) {
+      I[lane_idx] = static_cast<std::uint16_t>(5 * VX[lane_idx]);
+    }
+  } else if (ins.handler == &CPU::op_2NNN) {
+    for (CHIP8* chip8 : lanes) {
+      chip8->stack[chip8->stack_pointer & 0xF] = next_pc;
+      ++chip8->stack_pointer;
+    }
+    next_pc = ins.NNN;
+  } else if (ins.handler == &CPU::op_00EE) {
+    for (std::size_t lane_idx {0}; lane_idx < Lanes; ++lane_idx) {
+      CHIP8& chip8 {*lanes[lane_idx]};
+      --chip8.stack_pointer;
+      pc[lane_idx] = chip8.stack[chip8.stack_pointer & 0xF];
+    }
+    return true;
+  } else if (ins.handler == &CPU::op_CXNN) {
+    for (std::size_t lane_idx {0}; lane_idx < Lanes; ++lane_idx) {
+      VX[lane_idx] = lanes[lane_idx]->random_byte() & ins.NN;
+    }
+  } else if (ins.handler == &CPU::op_EX9E || ins.handler == &CPU::op_EXA1) {
+    const bool skip_if_pressed {ins.handler == &CPU::op_EX9E};
+    for (std::size_t lane_idx {0}; lane_idx < Lanes; ++lane_idx) {
+      const bool pressed {
+        ((lanes[lane_idx]->keypad >> (VX[lane_idx] & 0xF)) & 1) != 0};
+      const bool skip {pressed == skip_if_pressed};
+      pc[lane_idx] = static_cast<std::uint16_t>(next_pc + (skip ? 2 : 0));
+    }
+    return true;
+  } else if (ins.handler == &CPU::op_FX07) {
+    flush_ticks();
+    for (std::size_t lane_idx {0}; lane_idx < Lanes; ++lane_idx) {
+      VX[lane_idx] = lanes[lane_idx]->delay_timer;
+    }
+  } else if (ins.handler == &CPU::op_FX15 || ins.handler == &CPU::op_FX18) {
+    flush_ticks();
+    const bool delay {ins.handler == &CPU::op_FX15};
+    for (std::size_t lane_idx {0}; lane_idx < Lanes; ++lane_idx) {
+      (delay ? lanes[lane_idx]->delay_timer : lanes[lane_idx]->sound_timer) =
+        VX[lane_idx];
+    }
+  } else {
+    return false;
+  }
+  pc.fill(next_pc);
+  return true;
+}
+
+/*
+ * Executes ins on each lane separately through its CPU handler. The registers
+ * stay in the batch; only those the instruction can read or write are copied
+ * to the lane and back.
+ */
+template <std::size_t Lanes>
+void LockstepBatch<Lanes>::step_lanes(const Instruction& ins) {
+  // Range of memory written by this step, checked afterwards for whether the
+  // lanes still hold the same memory.
+  std::size_t written_begin {0x1000};
+  std::size_t written_end {0};
+  for (std::size_t lane_idx {0}; lane_idx < Lanes; ++lane_idx) {
+    CHIP8& chip8 {*lanes[lane_idx]};
+    const std::uint16_t pattern {
+      static_cast<std::uint16_t>(ins.opcode & 0xF0FF)};
+    if (pattern == 0xF007 || pattern == 0xF015 || pattern == 0xF018) {
+      flush_ticks();
+    } else if (pattern == 0xF033 || pattern == 0xF055) {
+      const std::size_t begin {I[lane_idx] & 0xFFFu};
+      written_begin = std::min(written_begin, begin);
+      written_end = std::max(
+        written_end, begin + (pattern == 0xF033 ? 3 : ins.X + 1u));
+    }
+    // FX55 and FX65 transfer V0 to VX, everything else only touches VX, VY,
+    // VF and, for BNNN, V0.
+    const std::size_t last {
+      pattern == 0xF055 || pattern == 0xF065 ? ins.X : std::size_t {0}};
+    for (std::size_t reg {0}; reg <= last; ++reg) {
+      chip8.V[reg] = V[reg][lane_idx];
+    }
+    chip8.V[ins.X] = V[ins.X][lane_idx];
+    chip8.V[ins.Y] = V[ins.Y][lane_idx];
+    chip8.V[0xF] = V[0xF][lane_idx];
+    chip8.I = I[lane_idx];
+    chip8.pc = static_cast<std::uint16_t>((pc[lane_idx] & 0xFFF) + 2);
+    ins.handler(&chip8, ins);
+    for (std::size_t reg {0}; reg <= last; ++reg) {
+      V[reg][lane_idx] = chip8.V[reg];
+    }
+    V[ins.X][lane_idx] = chip8.V[ins.X];
+    V[0xF][lane_idx] = chip8.V[0xF];
+    I[lane_idx] = chip8.I;
+    pc[lane_idx] = chip8.pc;
+  }
+  if (shared_memory && written_begin < written_end) {
+    // A write past the end of memory wraps around to its start.
+    shared_memory = written_end <= 0x1000
+                    ? memory_matches(written_begin, written_end)
+                    : memory_matches(0, 0x1000);
+  }
+}
+
+/*
+ * Runs every lane on its own through its interpreter, which keeps a lane's
+ * state in the cache for the whole slice instead of switching lanes after
+ * every instruction.
+ */
+template <std::size_t Lanes>
+void LockstepBatch<Lanes>::run_apart(std::size_t slice) {
+  flush_ticks();
+  for (std::size_t lane_idx {0}; lane_idx < Lanes; ++lane_idx) {
+    CHIP8& chip8 {*lanes[lane_idx]};
+    for (std::size_t reg {0}; reg < 16; ++reg) {
+      chip8.V[reg] = V[reg][lane_idx];
+    }
+    chip8.I = I[lane_idx];
+    chip8.pc = pc[lane_idx];
+    chip8.run(slice);
+    for (std::size_t reg {0}; reg < 16; ++reg) {
+      V[reg][lane_idx] = chip8.V[reg];
+    }
+    I[lane_idx] = chip8.I;
+    pc[lane_idx] = chip8.pc;
+  }
+  // Only worth comparing once the lanes are back at the same instruction.
+  bool rejoined {true};
+  for (std::size_t lane_idx {1}; lane_idx < Lanes; ++lane_idx) {
+    rejoined &= pc[lane_idx] == pc[0];
+  }
+  shared_memory = rejoined && memory_matches(0, 0x1000);
+}
+
+template class LockstepBatch<8>;
+template class LockstepBatch<16>;
+template class LockstepBatch<32>;
@@ -0,0 +1,87 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "arena.h"
+#include "chip8.h"
+#include "instruction.h"
+#include "rom.h"
+
+/*
+ * Advances several copies of the same ROM in lockstep. The V, I and pc
+ * registers of all lanes are kept as a structure of arrays (V[16][Lanes]) so
+ * that, while every lane is at the same pc, the ALU and branch operations run
+ * for all lanes at once using SSE2, or AVX2 when built with
+ * CHIP8_ENABLE_AVX2 (plain loops if neither is available). Operations on
+ * the stack, timers, keypad and random numbers loop over the lanes, and the
+ * rest execute per lane through the regular CPU handlers, copying only the
+ * registers the instruction uses. The timers of the lanes are only brought up
+ * to date when an instruction reads or sets them.
+ *
+ * Once the lanes have diverged onto different program counters, each lane
+ * runs on its own interpreter for a slice of DIVERGED_SLICE instructions at a
+ * time. The lanes rejoin the vector path when their program counters match at
+ * the end of a slice.
+ *
+ * Each lane is a complete CHIP8 which owns the memory, display, stack and
+ * timers; it can be accessed through lane() between calls to run() to give
+ * the lanes different inputs or registers.
+ */
+template <std::size_t Lanes>
+class LockstepBatch {
+  static_assert(Lanes == 8 || Lanes == 16 || Lanes == 32,
+                "A batch runs 8, 16 or 32 lanes.");
+
+  // Instructions diverged lanes run on their own before the batch checks
+  // whether they are back at the same instruction.
+  static constexpr std::size_t DIVERGED_SLICE {256};
+
+public:
+  explicit LockstepBatch(const RomImage& rom);
+  // Executes the given number of instructions on every lane.
+  void run(std::size_t cycles);
+  CHIP8& lane(std::size_t idx);
+  // Steps executed for all lanes at once, and steps executed lane by lane
+  // because the lanes diverged or the operation has no vector form.
+  std::uint64_t lockstep_steps() const;
+  std::uint64_t scalar_steps() const;
+
+private:
+  // Copies the registers from the lanes into the batch and back.
+  void gather();
+  void scatter();
+  // Counts the pending cycles down on the timers of every lane.
+  void flush_ticks();
+  // True if every lane holds the same bytes in [begin, end) as the first.
+  bool memory_matches(std::size_t begin, std::size_t end) const;
+  // True if every lane is at the same instruction.
+  bool together() const;
+  bool step_lockstep(const Instruction& ins);
+  void step_lanes(const Instruction& ins);
+  // Runs the lanes one after the other for slice instructions each.
+  void run_apart(std::size_t slice);
+
+private:
+  alignas(32) std::array<std::array<std::uint8_t, Lanes>, 16> V;
+  std::array<std::uint16_t, Lanes> I;
+  std::array<std::uint16_t, Lanes> pc;
+  // Holds the lanes side by side in a single allocation.
+  MachineArena arena;
+  std::array<CHIP8*, Lanes> lanes;
+  // Set while the memory of all lanes is identical, so that lanes at the
+  // same pc are known to be at the same instruction.
+  bool shared_memory;
+  // Instructions executed since the timers of the lanes were last updated.
+  std::uint64_t pending_cycles;
+  std::uint64_t lockstep_count;
+  std::uint64_t scalar_count;
+};
+
+extern template class LockstepBatch<8>;
+extern template class LockstepBatch<16>;
+extern template class LockstepBatch<32>;
+
+#endif // BATCH_H
@@ -0,0 +1,218 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "arena.h"
+#include "batch.h"
+#include "chip8.h"
+#include "cpu.h"
+#include "instruction.h"
+#include "pool.h"
+#include "quirks.h"
+#include "rom.h"
+
+/*
+ * Micro-benchmarks for the CPU core. Results are written to stdout as JSON:
+ *   handlers  ns per call of every CPU::op_* handler
+ *   dxyn      ns per DXYN by sprite height, with and without wrapping
+ *   roms      end-to-end million instructions per second for each ROM and
+ *             execution mode. Cycles that run skipped in idle loops are
+ *             reported separately and left out of the rate.
+ *   lanes     million instructions per second of a LockstepBatch and of an
+ *             EmulatorPool on one thread running as many copies of each ROM,
+ *             with one random number stream for all copies, which keeps them
+ *             in lockstep, or one stream per copy. ROMs that halt are left
+ *             out.
+ */
+namespace {
+constexpr std::size_t HANDLER_ITERATIONS {2000000};
+constexpr std::size_t DXYN_ITERATIONS {500000};
+constexpr std::uint64_t ROM_CYCLES {20000000};
+constexpr std::uint64_t LANE_CYCLES {1000000};
+constexpr std::uint64_t POOL_SLICE_CYCLES {100000};
+
+// A representative opcode for every handler.
+struct Operation {
+  const char* name;
+  std::uint16_t opcode;
+};
+
+const std::vector<Operation> OPERATIONS {
+  {"0NNN", 0x0300}, {"00E0", 0x00E0}, {"00EE", 0x00EE}, {"1NNN", 0x1200},
+  {"2NNN", 0x2200}, {"3XNN", 0x3112}, {"4XNN", 0x4112}, {"5XY0", 0x5120},
+  {"6XNN", 0x6112}, {"7XNN", 0x7112}, {"8XY0", 0x8120}, {"8XY1", 0x8121},
+  {"8XY2", 0x8122}, {"8XY3", 0x8123}, {"8XY4", 0x8124}, {"8XY5", 0x8125},
+  {"8XY6", 0x8126}, {"8XY7", 0x8127}, {"8XYE", 0x812E}, {"9XY0", 0x9120},
+  {"ANNN", 0xA300}, {"BNNN", 0xB200}, {"CXNN", 0xC1FF}, {"DXYN", 0xD125},
+  {"EX9E", 0xE19E}, {"EXA1", 0xE1A1}, {"FX07", 0xF107}, {"FX0A", 0xF10A},
+  {"FX15", 0xF115}, {"FX18", 0xF118}, {"FX1E", 0xF11E}, {"FX29", 0xF129},
+  {"FX33", 0xF133}, {"FX55", 0xF155}, {"FX65", 0xF165}
+};
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  const std::chrono::duration<double> elapsed {
+    std::chrono::steady_clock::now() - start};
+  return elapsed.count();
+}
+
+double time_handler(CHIP8& chip8, const Instruction& ins,
+                    std::size_t iterations) {
+  const auto start {std::chrono::steady_clock::now()};
+  for (std::size_t iteration {0}; iteration < iterations; ++iteration) {
+    // Keep the program counter and I inside the program area.
+    chip8.pc = 0x300;
+    chip8.I = 0x400;
+    ins.handler(&chip8, ins);
+  }
+  return seconds_since(start) * 1e9 / iterations;
+}
+
+void bench_handlers(const std::string& rom, std::ostream& out) {
+  CHIP8 chip8 {rom};
+  out << "  \"handlers\": [\n";
+  for (std::size_t idx {0}; idx < OPERATIONS.size(); ++idx) {
+    const Instruction ins {CPU::decode<Chip8Quirks>(OPERATIONS[idx].opcode)};
+    out << "    {\"op\": \"" << OPERATIONS[idx].name << "\", \"ns\": "
+        << time_handler(chip8, ins, HANDLER_ITERATIONS) << '}'
+        << (idx + 1 < OPERATIONS.size() ? "," : "") << '\n';
+  }
+  out << "  ],\n";
+}
+
+void bench_dxyn(const std::string& rom, std::ostream& out) {
+  CHIP8 chip8 {rom};
+  out << "  \"dxyn\": [\n";
+  for (std::uint16_t height {1}; height <= 15; ++height) {
+    for (const bool wrap : {false, true}) {
+      // Draw at (0, 0), or at (60, 28) so the sprite wraps on both axes.
+      chip8.V[0x1] = wrap ? 60 : 0;
+      chip8.V[0x2] = wrap ? 28 : 0;
+      const Instruction ins {CPU::decode<Chip8Quirks>(
+        static_cast<std::uint16_t>(0xD120 | height))};
+      out << "    {\"height\": " << height << ", \"wrap\": "
+          << (wrap ? "true" : "false") << ", \"ns\": "
+          << time_handler(chip8, ins, DXYN_ITERATIONS) << '}'
+          << (height < 15 || !wrap ? "," : "") << '\n';
+    }
+  }
+  out << "  ],\n";
+}
+
+void bench_roms(const std::vector<std::string>& roms, std::ostream& out) {
+  out << "  \"roms\": [\n";
+  for (std::size_t idx {0}; idx < roms.size(); ++idx) {
+    for (const ExecutionMode mode : {ExecutionMode::INTERPRETER,
+                                     ExecutionMode::BLOCKS}) {
+      CHIP8 chip8 {roms[idx]};
+      chip8.mode = mode;
+      const auto start {std::chrono::steady_clock::now()};
+      chip8.run(ROM_CYCLES);
+      const double seconds {seconds_since(start)};
+      const std::uint64_t executed {chip8.cycles - chip8.idle_cycles};
+      const bool last {idx + 1 == roms.size() && mode == ExecutionMode::BLOCKS};
+      out << "    {\"rom\": \"" << roms[idx] << "\", \"mode\": \""
+          << (mode == ExecutionMode::BLOCKS ? "blocks" : "interpreter")
+          << "\", \"cycles\": " << ROM_CYCLES << ", \"executed\": "
+          << executed << ", \"skipped\": " << chip8.idle_cycles
+          << ", \"mips\": " << executed / seconds / 1e6 << '}'
+          << (last ? "" : ",") << '\n';
+    }
+  }
+  out << "  ],\n";
+}
+
+// Instructions executed by the machines, without those skipped in idle loops.
+template <typename Machines>
+std::uint64_t executed(Machines& machines, std::size_t count) {
+  std::uint64_t total {0};
+  for (std::size_t idx {0}; idx < count; ++idx) {
+    total += machines(idx).cycles - machines(idx).idle_cycles;
+  }
+  return total;
+}
+
+// Returns false without writing anything if the ROM halts, as the pool stops
+// running a halted instance while the batch keeps executing it.
+template <std::size_t Lanes>
+bool bench_lanes(const std::string& rom_path, bool streams,
+                 const char* separator, std::ostream& out) {
+  const RomImage rom {rom_path};
+  MachineArena arena {Lanes};
+  EmulatorPool pool {1, POOL_SLICE_CYCLES};
+  LockstepBatch<Lanes> batch {rom};
+  for (std::size_t idx {0}; idx < Lanes; ++idx) {
+    CHIP8* chip8 {arena.acquire(rom)};
+    chip8->set_seed(1, streams ? idx : 0);
+    pool.add(*chip8, LANE_CYCLES);
+    batch.lane(idx).set_seed(1, streams ? idx : 0);
+  }
+  auto start {std::chrono::steady_clock::now()};
+  pool.run();
+  const double pool_seconds {seconds_since(start)};
+  for (std::size_t idx {0}; idx < Lanes; ++idx) {
+    if (pool.stats(idx).halted) {
+      return false;
+    }
+  }
+  start = std::chrono::steady_clock::now();
+  batch.run(LANE_CYCLES);
+  const double batch_seconds {seconds_since(start)};
+  auto pool_instance = [&pool](std::size_t idx) -> CHIP8& {
+    return pool.instance(idx);
+  };
+  auto batch_lane = [&batch](std::size_t idx) -> CHIP8& {
+    return batch.lane(idx);
+  };
+  const double pool_mips {executed(pool_instance, Lanes) / pool_seconds / 1e6};
+  const double batch_mips {
+    executed(batch_lane, Lanes) / batch_seconds / 1e6};
+  out << separator << "    {\"rom\": \"" << rom_path << "\", \"lanes\": "
+      << Lanes << ", \"seeds\": \"" << (streams ? "streams" : "shared")
+      << "\", \"lockstep_steps\": " << batch.lockstep_steps()
+      << ", \"batch_mips\": " << batch_mips << ", \"pool_mips\": "
+      << pool_mips << ", \"speedup\": " << batch_mips / pool_mips << '}';
+  return true;
+}
+
+void bench_lanes(const std::vector<std::string>& roms, std::ostream& out) {
+  out << "  \"lanes\": [\n";
+  const char* separator {""};
+  for (const std::string& rom : roms) {
+    for (const bool streams : {false, true}) {
+      if (bench_lanes<8>(rom, streams, separator, out)) {
+        separator = ",\n";
+        bench_lanes<32>(rom, streams, separator, out);
+      }
+    }
+  }
+  out << "\n  ]\n";
+}
+} // namespace
+
+int main(int argc, char* argv[]) {
+  std::vector<std::string> roms {};
+  for (int arg_idx {1}; arg_idx < argc; ++arg_idx) {
+    roms.push_back(argv[arg_idx]);
+  }
+  if (roms.empty()) {
+    const std::string source_dir {CHIP8_SOURCE_DIR};
+    roms = {source_dir + "/roms/pong.ch8", source_dir + "/roms/tetris.ch8",
+            source_dir + "/test/BC_test.ch8"};
+  }
+  try {
+    std::cout << "{\n";
+    bench_handlers(roms.front(), std::cout);
+    bench_dxyn(roms.front(), std::cout);
+    bench_roms(roms, std::cout);
+    bench_lanes(roms, std::cout);
+    std::cout << "}\n";
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,233 @@
+#include "capture.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "chip8.h"
+#include "spsc_ring.h"
+
+namespace {
+constexpr std::array<char, 4> MAGIC {'C', '8', 'F', 'C'};
+constexpr std::uint8_t VERSION {1};
+// Bytes in the XOR delta of one frame.
+constexpr std::size_t FRAME_BYTES {32 * 8};
+// How long the writer sleeps when it has caught up with the emulator.
+constexpr std::chrono::microseconds WRITER_IDLE {200};
+
+template <typename T>
+void put(std::vector<std::uint8_t>& out, T value) {
+  for (std::size_t byte {0}; byte < sizeof(T); ++byte) {
+    out.push_back(static_cast<std::uint8_t>(value >> (8 * byte)));
+  }
+}
+
+void put_varint(std::vector<std::uint8_t>& out, std::uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<std::uint8_t>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<std::uint8_t>(value));
+}
+
+// Returns false if the stream ended before the first byte.
+template <typename T>
+bool get(std::istream& in, T& value) {
+  value = 0;
+  for (std::size_t byte {0}; byte < sizeof(T); ++byte) {
+    const int next {in.get()};
+    if (next == std::istream::traits_type::eof()) {
+      if (byte == 0) {
+        return false;
+      }
+      throw std::invalid_argument("The capture is truncated.");
+    }
+    value |= static_cast<T>(static_cast<T>(next & 0xFF) << (8 * byte));
+  }
+  return true;
+}
+
+bool get_varint(std::istream& in, std::uint64_t& value) {
+  value = 0;
+  for (unsigned shift {0}; shift < 64; shift += 7) {
+    const int next {in.get()};
+    if (next == std::istream::traits_type::eof()) {
+      if (shift == 0) {
+        return false;
+      }
+      throw std::invalid_argument("The capture is truncated.");
+    }
+    value |= static_cast<std::uint64_t>(next & 0x7F) << shift;
+    if (!(next & 0x80)) {
+      return true;
+    }
+  }
+  throw std::invalid_argument("The capture contains an invalid frame.");
+}
+
+/*
+ * Appends the zero-run/literal encoding of delta to out. A literal run only
+ * ends at two consecutive zero bytes, a single zero is cheaper to store as a
+ * literal than as a new run.
+ */
+void encode_delta(const std::array<std::uint8_t, FRAME_BYTES>& delta,
+                  std::vector<std::uint8_t>& out) {
+  std::size_t pos {0};
+  while (pos < FRAME_BYTES) {
+    const std::size_t zeros_start {pos};
+    while (pos < FRAME_BYTES && delta[pos] == 0) {
+      ++pos;
+    }
+    const std::size_t literals_start {pos};
+    while (pos < FRAME_BYTES
+           && (delta[pos] != 0
+               || (pos + 1 < FRAME_BYTES && delta[pos + 1] != 0))) {
+      ++pos;
+    }
+    put_varint(out, literals_start - zeros_start);
+    put_varint(out, pos - literals_start);
+    out.insert(out.end(), delta.begin() + literals_start, delta.begin() + pos);
+  }
+}
+} // namespace
+
+constexpr std::size_t FrameRecorder::QUEUE_CAPACITY;
+
+FrameRecorder::FrameRecorder(std::ostream& stream, const CHIP8& chip8,
+                             bool lossless)
+  : out {stream}, queue {new SpscRing<Frame, QUEUE_CAPACITY> {}},
+    start_cycle {chip8.cycles}, wait_for_writer {lossless}, dropped_frames {0},
+    stopping {false}, writer {} {
+  std::vector<std::uint8_t> header {MAGIC.begin(), MAGIC.end()};
+  header.push_back(VERSION);
+  put(header, chip8.cycles_per_tick);
+  out.write(reinterpret_cast<const char*>(header.data()),
+            static_cast<std::streamsize>(header.size()));
+  writer = std::thread {&FrameRecorder::write_frames, this};
+}
+
+FrameRecorder::~FrameRecorder() {
+  stopping.store(true, std::memory_order_release);
+  writer.join();
+  out.flush();
+}
+
+void FrameRecorder::capture(const CHIP8& chip8, std::uint32_t changed_rows) {
+  if (!changed_rows) {
+    return;
+  }
+  const Frame frame {chip8.cycles, chip8.display};
+  while (!queue->try_push(frame)) {
+    if (!wait_for_writer) {
+      ++dropped_frames;
+      return;
+    }
+    std::this_thread::yield();
+  }
+}
+
+std::uint64_t FrameRecorder::dropped() const {
+  return dropped_frames;
+}
+
+/**
+ * Runs on the writer thread: encodes each queued frame against the one before
+ * it, so the emulator only ever pays for copying the display into the queue.
+ */
+void FrameRecorder::write_frames() {
+  std::array<std::uint64_t, 32> previous {};
+  std::uint64_t previous_cycle {start_cycle};
+  std::array<std::uint8_t, FRAME_BYTES> delta {};
+  std::vector<std::uint8_t> encoded {};
+  Frame frame {};
+  while (true) {
+    // Read the flag first, so the last frames pushed before the destructor
+    // ran are still drained below.
+    const bool stop {stopping.load(std::memory_order_acquire)};
+    if (!queue->try_pop(frame)) {
+      if (stop) {
+        return;
+      }
+      std::this_thread::sleep_for(WRITER_IDLE);
+      continue;
+    }
+    for (std::size_t row {0}; row < 32; ++row) {
+      const std::uint64_t changes {frame.display[row] ^ previous[row]};
+      for (std::size_t byte {0}; byte < 8; ++byte) {
+        delta[row * 8 + byte] =
+          static_cast<std::uint8_t>(changes >> (56 - 8 * byte));
+      }
+    }
+    encoded.clear();
+    put_varint(encoded, frame.cycle - previous_cycle);
+    encode_delta(delta, encoded);
+    out.write(reinterpret_cast<const char*>(encoded.data()),
+              static_cast<std::streamsize>(encoded.size()));
+    previous = frame.display;
+    previous_cycle = frame.cycle;
+  }
+}
+
+FrameReader::FrameReader(std::istream& stream)
+  : in {stream}, tick_length {0}, frame_cycle {0}, frame {} {
+  std::array<char, 4> magic {};
+  std::uint8_t version {0};
+  if (!in.read(magic.data(), magic.size()) || magic != MAGIC
+      || !get(in, version)) {
+    throw std::invalid_argument("The data is not a CHIP-8 frame capture.");
+  }
+  if (version != VERSION) {
+    throw std::invalid_argument("Unsupported frame capture version.");
+  }
+  if (!get(in, tick_length)) {
+    throw std::invalid_argument("The capture is truncated.");
+  }
+}
+
+bool FrameReader::next() {
+  std::uint64_t cycle_delta {0};
+  if (!get_varint(in, cycle_delta)) {
+    return false;
+  }
+  std::size_t pos {0};
+  while (pos < FRAME_BYTES) {
+    std::uint64_t zeros {0};
+    std::uint64_t literals {0};
+    if (!get_varint(in, zeros) || !get_varint(in, literals)) {
+      throw std::invalid_argument("The capture is truncated.");
+    }
+    if (zeros > FRAME_BYTES - pos || literals > FRAME_BYTES - pos - zeros) {
+      throw std::invalid_argument("The capture contains an invalid frame.");
+    }
+    pos += zeros;
+    for (; literals > 0; --literals, ++pos) {
+      std::uint8_t byte {0};
+      if (!get(in, byte)) {
+        throw std::invalid_argument("The capture is truncated.");
+      }
+      frame[pos / 8] ^=
+        static_cast<std::uint64_t>(byte) << (56 - 8 * (pos % 8));
+    }
+  }
+  frame_cycle += cycle_delta;
+  return true;
+}
+
+const std::array<std::uint64_t, 32>& FrameReader::display() const {
+  return frame;
+}
+
+std::uint64_t FrameReader::cycle() const {
+  return frame_cycle;
+}
+
+std::uint32_t FrameReader::cycles_per_tick() const {
+  return tick_length;
+}
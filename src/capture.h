@@ -0,0 +1,92 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <thread>
+
+#include "chip8.h"
+#include "spsc_ring.h"
+
+/*
+ * A compact log of every frame in which the display changed. Each frame is
+ * stored as the XOR against the previous one, which is zero except where
+ * sprites moved, and the zero runs are run-length encoded.
+ *
+ * Layout, all fixed-size integers little-endian:
+ *   "C8FC" magic, 1 byte format version
+ *   u32 cycles_per_tick of the recorded run
+ *   per frame:
+ *     LEB128 number of cycles since the previous frame
+ *     the 256 byte XOR delta, rows top to bottom with column 0 in the high
+ *     bit of the first byte of each row, as a sequence of
+ *       LEB128 count of zero bytes, LEB128 count of literal bytes, literals
+ *     until all 256 bytes are covered
+ */
+class FrameRecorder {
+public:
+  // Frames queued at most before capture has to drop or wait.
+  static constexpr std::size_t QUEUE_CAPACITY {1024};
+
+public:
+  // Writes the header and starts the writer thread, which owns stream until
+  // the recorder is destroyed. With lossless set, capture waits for the
+  // writer instead of dropping frames, which stalls the emulator whenever
+  // the writer falls behind.
+  FrameRecorder(std::ostream& stream, const CHIP8& chip8, bool lossless);
+  FrameRecorder(const FrameRecorder&) = delete;
+  FrameRecorder& operator=(const FrameRecorder&) = delete;
+  // Writes every queued frame, then stops the writer thread.
+  ~FrameRecorder();
+  // Queues the display of chip8 if changed_rows, as returned by
+  // CHIP8::take_changed_rows, is not 0. If the writer fell QUEUE_CAPACITY
+  // frames behind, the frame is dropped unless the recorder is lossless.
+  // Every frame is stored whole in the queue, so the next recorded frame
+  // still decodes correctly after a drop.
+  void capture(const CHIP8& chip8, std::uint32_t changed_rows);
+  // Frames dropped so far because the writer fell behind.
+  std::uint64_t dropped() const;
+
+private:
+  struct Frame {
+    std::uint64_t cycle;
+    std::array<std::uint64_t, 32> display;
+  };
+
+  void write_frames();
+
+private:
+  std::ostream& out;
+  std::unique_ptr<SpscRing<Frame, QUEUE_CAPACITY>> queue;
+  std::uint64_t start_cycle;
+  bool wait_for_writer;
+  std::uint64_t dropped_frames;
+  std::atomic<bool> stopping;
+  std::thread writer;
+};
+
+class FrameReader {
+public:
+  // Reads the header. Throws std::invalid_argument if in is not a capture.
+  explicit FrameReader(std::istream& stream);
+  // Decodes the next frame. Returns false once the capture is exhausted.
+  bool next();
+  // The display of the frame decoded last, and the number of cycles between
+  // the start of the capture and that frame.
+  const std::array<std::uint64_t, 32>& display() const;
+  std::uint64_t cycle() const;
+  std::uint32_t cycles_per_tick() const;
+
+private:
+  std::istream& in;
+  std::uint32_t tick_length;
+  std::uint64_t frame_cycle;
+  std::array<std::uint64_t, 32> frame;
+};
+
+#endif // CAPTURE_H
@@ -0,0 +1,161 @@
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "capture.h"
+
+namespace {
+constexpr std::array<std::uint8_t, 8> PNG_SIGNATURE {
+  0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+// Largest block a stored (uncompressed) deflate block can hold.
+constexpr std::size_t STORED_BLOCK_SIZE {0xFFFF};
+
+std::array<std::uint32_t, 256> build_crc_table() {
+  std::array<std::uint32_t, 256> table {};
+  for (std::uint32_t idx {0}; idx < table.size(); ++idx) {
+    std::uint32_t crc {idx};
+    for (int bit {0}; bit < 8; ++bit) {
+      crc = crc & 1 ? 0xEDB88320u ^ (crc >> 1) : crc >> 1;
+    }
+    table[idx] = crc;
+  }
+  return table;
+}
+
+const std::array<std::uint32_t, 256> CRC_TABLE {build_crc_table()};
+
+void put_u32(std::vector<std::uint8_t>& out, std::uint32_t value) {
+  for (int shift {24}; shift >= 0; shift -= 8) {
+    out.push_back(static_cast<std::uint8_t>(value >> shift));
+  }
+}
+
+void put_chunk(std::vector<std::uint8_t>& out, const char* type,
+               const std::vector<std::uint8_t>& data) {
+  put_u32(out, static_cast<std::uint32_t>(data.size()));
+  const std::size_t type_start {out.size()};
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data.begin(), data.end());
+  std::uint32_t crc {0xFFFFFFFF};
+  for (std::size_t idx {type_start}; idx < out.size(); ++idx) {
+    crc = CRC_TABLE[(crc ^ out[idx]) & 0xFF] ^ (crc >> 8);
+  }
+  put_u32(out, crc ^ 0xFFFFFFFF);
+}
+
+/*
+ * Wraps raw in a zlib stream made of stored deflate blocks. The frames are
+ * tiny, so leaving them uncompressed keeps the writer trivial.
+ */
+std::vector<std::uint8_t> zlib_stored(const std::vector<std::uint8_t>& raw) {
+  std::vector<std::uint8_t> out {0x78, 0x01};
+  std::size_t pos {0};
+  do {
+    const std::size_t length {raw.size() - pos < STORED_BLOCK_SIZE
+                              ? raw.size() - pos : STORED_BLOCK_SIZE};
+    const bool last {pos + length == raw.size()};
+    out.push_back(last ? 1 : 0);
+    out.push_back(static_cast<std::uint8_t>(length));
+    out.push_back(static_cast<std::uint8_t>(length >> 8));
+    out.push_back(static_cast<std::uint8_t>(~length));
+    out.push_back(static_cast<std::uint8_t>(~length >> 8));
+    out.insert(out.end(), raw.begin() + pos, raw.begin() + pos + length);
+    pos += length;
+  } while (pos < raw.size());
+  std::uint32_t a {1};
+  std::uint32_t b {0};
+  for (const std::uint8_t byte : raw) {
+    a = (a + byte) % 65521;
+    b = (b + a) % 65521;
+  }
+  put_u32(out, (b << 16) | a);
+  return out;
+}
+
+// Encodes the display as an 8-bit grayscale PNG, each pixel scaled up to a
+// scale x scale square.
+std::vector<std::uint8_t> encode_png(
+    const std::array<std::uint64_t, 32>& display, std::size_t scale) {
+  const std::size_t width {64 * scale};
+  const std::size_t height {32 * scale};
+  std::vector<std::uint8_t> raw {};
+  raw.reserve(height * (width + 1));
+  for (std::size_t y {0}; y < height; ++y) {
+    raw.push_back(0); // no filter
+    const std::uint64_t row {display[y / scale]};
+    for (std::size_t x {0}; x < width; ++x) {
+      raw.push_back((row >> (63 - x / scale)) & 1 ? 0xFF : 0x00);
+    }
+  }
+  std::vector<std::uint8_t> header {};
+  put_u32(header, static_cast<std::uint32_t>(width));
+  put_u32(header, static_cast<std::uint32_t>(height));
+  header.insert(header.end(), {8, 0, 0, 0, 0}); // 8-bit grayscale
+  std::vector<std::uint8_t> png {PNG_SIGNATURE.begin(), PNG_SIGNATURE.end()};
+  put_chunk(png, "IHDR", header);
+  put_chunk(png, "IDAT", zlib_stored(raw));
+  put_chunk(png, "IEND", {});
+  return png;
+}
+} // namespace
+
+/*
+ * Converts a frame capture written by chip8-headless --capture into one PNG
+ * per frame, named <prefix>000000.png, <prefix>000001.png and so on.
+ */
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    std::cout << "Missing arguments. (e.g. \"./chip8-capture-png "
+              << "<$CAPTURE_PATH> <$OUTPUT_PREFIX> [--scale N]\")\n";
+    return 1;
+  }
+  const std::string capture_path {argv[1]};
+  const std::string prefix {argv[2]};
+  std::size_t scale {1};
+  for (int arg_idx {3}; arg_idx < argc; ++arg_idx) {
+    const std::string option {argv[arg_idx]};
+    if (option == "--scale" && arg_idx + 1 < argc) {
+      scale = std::strtoul(argv[++arg_idx], nullptr, 10);
+    } else {
+      std::cerr << "Unknown option: " << option << '\n';
+      return 1;
+    }
+  }
+  if (scale < 1 || scale > 64) {
+    std::cerr << "The scale must be between 1 and 64.\n";
+    return 1;
+  }
+  try {
+    std::ifstream in {capture_path, std::ios::binary};
+    if (!in) {
+      std::cerr << "Capture could not be found.\n";
+      return 1;
+    }
+    FrameReader reader {in};
+    std::size_t frame_idx {0};
+    for (; reader.next(); ++frame_idx) {
+      std::array<char, 16> number {};
+      std::snprintf(number.data(), number.size(), "%06zu", frame_idx);
+      const std::vector<std::uint8_t> png {encode_png(reader.display(), scale)};
+      std::ofstream out {prefix + number.data() + ".png", std::ios::binary};
+      out.write(reinterpret_cast<const char*>(png.data()),
+                static_cast<std::streamsize>(png.size()));
+      if (!out) {
+        std::cerr << "Could not write " << prefix << number.data() << ".png\n";
+        return 1;
+      }
+    }
+    std::cout << frame_idx << " frames written\n";
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
@@ -3,17 +3,13 @@
 #include <array>
 #include <cstdint>
 #include <string>
-#include <vector>
-#include <stdexcept>
 #include <ctime>
 #include <cstdlib>
-#include <iostream>
-#include <unordered_map>
-#include <fstream>
-#include <ios>
+#include <algorithm>
+#include <memory>
 
-#include <SDL2/SDL.h>
 #include "cpu.h"
+#include "profiler.h"
 
 /*
  * Contains the sprites (in ascending order) CHIP-8 programs could refer to.
@@ -41,65 +37,394 @@ constexpr std::array<std::uint8_t, 16 * 5> SPRITES {
   0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-std::unordered_map<std::int32_t, std::uint8_t> CHIP8::KEYPAD {
-  {SDLK_1, 0x0}, {SDLK_2, 0x1}, {SDLK_3, 0x2}, {SDLK_4, 0x3},
-  {SDLK_q, 0x4}, {SDLK_w, 0x5}, {SDLK_e, 0x6}, {SDLK_r, 0x7},
-  {SDLK_a, 0x8}, {SDLK_s, 0x9}, {SDLK_d, 0xA}, {SDLK_f, 0xB},
-  {SDLK_z, 0xC}, {SDLK_x, 0xD}, {SDLK_c, 0xE}, {SDLK_v, 0xF}
-};
+constexpr std::uint32_t CHIP8::DEFAULT_CLOCK_HZ;
+constexpr std::uint32_t CHIP8::TIMER_HZ;
+
+CHIP8::CHIP8(const std::string& file_loc) : CHIP8(RomImage {file_loc}) {}
+
+CHIP8::CHIP8(const RomImage& rom)
+  : V {std::array<std::uint8_t, 16>{}}, pc {0x200}, I {0}, stack_pointer {0},
+    delay_timer {0}, sound_timer {0}, waiting_for_key {false}, keypad {0},
+    wait_held_keys {0}, dirty_rows {0},
+    cycles_per_tick {DEFAULT_CLOCK_HZ / TIMER_HZ},
+    tick_countdown {DEFAULT_CLOCK_HZ / TIMER_HZ}, cycles {0},
+    mode {ExecutionMode::INTERPRETER}, quirks {QuirkProfile::CHIP8},
+    stack {std::array<std::uint16_t, 16>{}},
+    mem {std::array<std::uint8_t, 4096>{}},
+    display {std::array<std::uint64_t, 32>{}},
+    presented {std::array<std::uint64_t, 32>{}}, idle_cycles {0},
+    unknown_operations {0}, last_unknown_opcode {0},
+    rng_seed {static_cast<std::uint64_t>(std::time(nullptr))},
+    rng {rng_seed, 0}, icache {}, translator {}, snapshot_pages {},
+    dirty_pages {0xFFFF} {
+  load(rom);
+}
 
-std::vector<std::uint8_t>* CHIP8::read_program(const std::string& file_loc) {
-  std::ifstream rom {file_loc, std::ios::binary};
-  if (!rom) {
-    throw std::runtime_error("File could not be found.");
+CHIP8::~CHIP8() = default;
+
+void CHIP8::reset(const RomImage& rom) {
+  V.fill(0);
+  pc = 0x200;
+  I = 0;
+  stack_pointer = 0;
+  delay_timer = 0;
+  sound_timer = 0;
+  waiting_for_key = false;
+  keypad = 0;
+  wait_held_keys = 0;
+  dirty_rows = 0;
+  tick_countdown = cycles_per_tick;
+  cycles = 0;
+  stack.fill(0);
+  mem.fill(0);
+  display.fill(0);
+  presented.fill(0);
+  idle_cycles = 0;
+  unknown_operations = 0;
+  last_unknown_opcode = 0;
+  rng = Pcg32 {rng_seed, rng.stream()};
+  for (Instruction& ins : icache) {
+    ins.handler = nullptr;
+  }
+  translator.flush();
+  for (std::shared_ptr<const Snapshot::Page>& page : snapshot_pages) {
+    page.reset();
   }
-  return new std::vector<std::uint8_t>{std::istreambuf_iterator<char>{rom}, {}};
+  dirty_pages = 0xFFFF;
+  load(rom);
 }
 
-CHIP8::CHIP8(const std::string& file_loc) 
-  : V {std::array<std::uint8_t, 16>{}}, pc {0x200}, I {0},
-    mem {std::array<std::uint8_t, 4096>{}}, stack_pointer {0},
-    stack {std::array<std::uint16_t, 16>{}},
-    display {std::array<std::array<std::uint8_t, 64>, 32>{}},
-    // FIXME: set timers to 60 or 0 at start?
-    delay_timer {60}, sound_timer {60}, redraw {false} {
+void CHIP8::load(const RomImage& rom) {
   // Load the fontset into the reserved memory.
   for (std::size_t idx {0}; idx < 0x50; ++idx) {
     mem[idx] = SPRITES[idx];
   }
-  // Fetch the instructions from the ROM.
-  std::vector<std::uint8_t>* rom {CHIP8::read_program(file_loc)};
-  if (0x200 + rom->size() > 0xFFF) {
-    throw std::invalid_argument(
-      "The ROM is too large for the CHIP-8 interpreter.");
-  }
-  // Load the program into memory.
-  for (std::size_t op_idx {0}; op_idx < rom->size(); ++op_idx) {
-    mem[0x200 + op_idx] = (*rom)[op_idx];
-  }
-  delete rom;
-  // Seed the random number generator.
-  std::srand(std::time(nullptr));
+  // Load the program into memory, RomImage has already checked its size.
+  std::copy_n(rom.data(), rom.size(), mem.begin() + 0x200);
 }
 
-CHIP8::~CHIP8() = default;
+std::uint16_t CHIP8::fetch(std::uint16_t address) const {
+  return static_cast<std::uint16_t>(
+    (mem[address & 0xFFF] << 8) | mem[(address + 1) & 0xFFF]);
+}
 
 void CHIP8::clock_cycle() {
-  const std::uint16_t& opcode {(V[pc] << 8) | V[pc + 1]};
+  NullProfiler profiler {};
+  clock_cycle(profiler);
+}
+
+std::size_t CHIP8::run(std::size_t budget) {
+  NullProfiler profiler {};
+  return run(budget, profiler);
+}
+
+template <typename Profiler>
+void CHIP8::clock_cycle(Profiler& profiler) {
+  switch (quirks) {
+    case QuirkProfile::CHIP8: step<Chip8Quirks>(profiler); break;
+    case QuirkProfile::CHIP48: step<Chip48Quirks>(profiler); break;
+    case QuirkProfile::SUPER_CHIP: step<SuperChipQuirks>(profiler); break;
+  }
+}
+
+template <typename Profiler>
+std::size_t CHIP8::run(std::size_t budget, Profiler& profiler) {
+  switch (quirks) {
+    case QuirkProfile::CHIP48:
+      return interpret<Chip48Quirks>(budget, profiler);
+    case QuirkProfile::SUPER_CHIP:
+      return interpret<SuperChipQuirks>(budget, profiler);
+    case QuirkProfile::CHIP8: break;
+  }
+  return interpret<Chip8Quirks>(budget, profiler);
+}
+
+/**
+ * The profiler hooks surround the handler call only, so that the time
+ * measured per handler excludes decoding and the timers. With NullProfiler
+ * they are empty and inlined away.
+ */
+template <typename Quirks, typename Profiler>
+void CHIP8::step(Profiler& profiler) {
+  const std::uint16_t address {static_cast<std::uint16_t>(pc & 0xFFF)};
   pc += 2;
-  switch (opcode & 0xF000) {
-    // TODO: implement switch statement for the current operation
-    default:
-      std::cerr << "Unknown operation: " << std::hex << std::uppercase
-                << opcode << '\n';
-      break;
+  if (address >= 0x200) {
+    Instruction& ins {icache[address - 0x200]};
+    if (!ins.handler) {
+      ins = CPU::decode<Quirks>(fetch(address));
+    }
+    profiler.begin(*this, address, ins);
+    ins.handler(this, ins);
+    profiler.end(*this, ins);
+  } else {
+    // The interpreter area is never cached, it only holds the fontset.
+    const Instruction ins {CPU::decode<Quirks>(fetch(address))};
+    profiler.begin(*this, address, ins);
+    ins.handler(this, ins);
+    profiler.end(*this, ins);
+  }
+  tick(1);
+}
+
+template <typename Quirks, typename Profiler>
+std::size_t CHIP8::interpret(std::size_t budget, Profiler& profiler) {
+  // Every idle loop jumps backwards, so only look for one where a previous
+  // run stopped and wherever control goes back. Skipped iterations never
+  // reach the profiler hooks, so a recording profiler sees them interpreted.
+  const bool skips_idle {Profiler::SKIPS_IDLE};
+  std::size_t executed {skips_idle ? skip_idle(budget) : 0};
+  while (executed < budget) {
+    const std::uint16_t address {pc};
+    if (Profiler::RUNS_BLOCKS && mode == ExecutionMode::BLOCKS) {
+      const std::size_t length {translator.execute(this, budget - executed)};
+      if (length) {
+        executed += length;
+        if (skips_idle && pc <= address) {
+          executed += skip_idle(budget - executed);
+        }
+        continue;
+      }
+    }
+    step<Quirks>(profiler);
+    ++executed;
+    if (skips_idle && pc <= address) {
+      executed += skip_idle(budget - executed);
+    }
+  }
+  return executed;
+}
+
+template void CHIP8::clock_cycle<NullProfiler>(NullProfiler&);
+template void CHIP8::clock_cycle<Profiler>(Profiler&);
+template std::size_t CHIP8::run<NullProfiler>(std::size_t, NullProfiler&);
+template std::size_t CHIP8::run<Profiler>(std::size_t, Profiler&);
+
+void CHIP8::set_clock(std::uint32_t hz) {
+  cycles_per_tick = hz > TIMER_HZ ? hz / TIMER_HZ : 1;
+  tick_countdown = cycles_per_tick - cycles % cycles_per_tick;
+}
+
+void CHIP8::set_quirks(QuirkProfile profile) {
+  quirks = profile;
+  for (Instruction& ins : icache) {
+    ins.handler = nullptr;
+  }
+  translator.flush();
+}
+
+void CHIP8::tick(std::uint64_t count) {
+  cycles += count;
+  if (count < tick_countdown) {
+    tick_countdown -= static_cast<std::uint32_t>(count);
+    return;
   }
+  const std::uint64_t elapsed {count - tick_countdown};
+  const std::uint64_t ticks {1 + elapsed / cycles_per_tick};
+  tick_countdown =
+    cycles_per_tick - static_cast<std::uint32_t>(elapsed % cycles_per_tick);
+  delay_timer = ticks < delay_timer ? delay_timer - ticks : 0;
+  sound_timer = ticks < sound_timer ? sound_timer - ticks : 0;
 }
 
-bool CHIP8::needs_redrawing() {
-  if (redraw) {
-    redraw = false;
+void CHIP8::memory_written(std::uint16_t address, std::size_t length) {
+  // An instruction starting one byte before the write overlaps it as well.
+  for (std::size_t offset {0}; offset <= length; ++offset) {
+    const std::size_t slot {(address + offset - 1) & 0xFFF};
+    if (slot >= 0x200) {
+      // Only the handler is cleared: the instruction performing the write may
+      // still be reading its own operands.
+      icache[slot - 0x200].handler = nullptr;
+    }
+  }
+  translator.invalidate(address, length);
+  for (std::size_t offset {0}; offset < length; ++offset) {
+    dirty_pages |= 1u << (((address + offset) & 0xFFF) / Snapshot::PAGE_SIZE);
+  }
+}
+
+std::uint8_t CHIP8::random_byte() {
+  return static_cast<std::uint8_t>(rng.next() >> 24);
+}
+
+void CHIP8::set_seed(std::uint64_t seed, std::uint64_t stream) {
+  rng_seed = seed;
+  rng = Pcg32 {seed, stream};
+}
+
+Snapshot CHIP8::snapshot() {
+  for (std::size_t page {0}; page < Snapshot::PAGE_COUNT; ++page) {
+    if ((dirty_pages & (1u << page)) || !snapshot_pages[page]) {
+      std::shared_ptr<Snapshot::Page> copy {std::make_shared<Snapshot::Page>()};
+      std::copy_n(mem.begin() + page * Snapshot::PAGE_SIZE,
+                  Snapshot::PAGE_SIZE, copy->begin());
+      snapshot_pages[page] = copy;
+    }
+  }
+  dirty_pages = 0;
+  return Snapshot {V, pc, I, stack_pointer, stack, display, delay_timer,
+                   sound_timer, keypad, waiting_for_key, wait_held_keys,
+                   rng, cycles, snapshot_pages};
+}
+
+void CHIP8::restore(const Snapshot& snapshot) {
+  V = snapshot.V;
+  pc = snapshot.pc;
+  I = snapshot.I;
+  stack_pointer = snapshot.stack_pointer;
+  stack = snapshot.stack;
+  display = snapshot.display;
+  delay_timer = snapshot.delay_timer;
+  sound_timer = snapshot.sound_timer;
+  keypad = snapshot.keypad;
+  waiting_for_key = snapshot.waiting_for_key;
+  wait_held_keys = snapshot.wait_held_keys;
+  rng = snapshot.rng;
+  cycles = snapshot.cycles;
+  tick_countdown = cycles_per_tick - cycles % cycles_per_tick;
+  dirty_rows = 0xFFFFFFFF;
+  for (std::size_t page {0}; page < Snapshot::PAGE_COUNT; ++page) {
+    if ((dirty_pages & (1u << page))
+        || snapshot_pages[page] != snapshot.pages[page]) {
+      const std::size_t address {page * Snapshot::PAGE_SIZE};
+      std::copy(snapshot.pages[page]->begin(), snapshot.pages[page]->end(),
+                mem.begin() + address);
+      memory_written(static_cast<std::uint16_t>(address), Snapshot::PAGE_SIZE);
+      snapshot_pages[page] = snapshot.pages[page];
+    }
+  }
+  dirty_pages = 0;
+}
+
+std::uint32_t CHIP8::take_changed_rows() {
+  std::uint32_t changed {0};
+  for (std::size_t row {0}; row < 32; ++row) {
+    if (((dirty_rows >> row) & 1) && display[row] != presented[row]) {
+      changed |= 1u << row;
+      presented[row] = display[row];
+    }
+  }
+  dirty_rows = 0;
+  return changed;
+}
+
+bool CHIP8::pixel(std::size_t x, std::size_t y) const {
+  return (display[y & 31] >> (63 - (x & 63))) & 1;
+}
+
+void CHIP8::set_key(std::uint8_t key, bool pressed) {
+  const std::uint16_t mask {static_cast<std::uint16_t>(1u << (key & 0xF))};
+  set_keypad(pressed ? keypad | mask : keypad & ~mask);
+}
+
+void CHIP8::set_keypad(std::uint16_t state) {
+  keypad = state;
+  // A key released during FX0A counts as soon as it is pressed again.
+  wait_held_keys &= state;
+}
+
+bool CHIP8::halted() const {
+  if (waiting_for_key && !(keypad & ~wait_held_keys)) {
     return true;
   }
+  switch (idle_loop()) {
+    case IdleLoop::JUMP_TO_SELF:
+    case IdleLoop::KEY_POLL:
+      return true;
+    case IdleLoop::TIMER_WAIT:
+      // The delay timer only counts down, so it never reaches a larger value.
+      return delay_timer < (fetch(pc + 2) & 0x00FF);
+    case IdleLoop::NONE: break;
+  }
   return false;
 }
+
+/**
+ * Only looks at memory and the registers, so a loop is recognized however it
+ * was reached and whether or not it has been decoded or translated.
+ */
+CHIP8::IdleLoop CHIP8::idle_loop() const {
+  if (pc < 0x200 || pc > 0xFFE) {
+    return IdleLoop::NONE;
+  }
+  const std::uint16_t jump_back {static_cast<std::uint16_t>(0x1000 | pc)};
+  const std::uint16_t first {fetch(pc)};
+  if (first == jump_back) {
+    return IdleLoop::JUMP_TO_SELF;
+  }
+  const std::uint8_t X {static_cast<std::uint8_t>((first >> 8) & 0xF)};
+  switch (first & 0xF0FF) {
+    case 0xE09E:
+    case 0xE0A1: {
+      if (fetch(pc + 2) != jump_back) {
+        return IdleLoop::NONE;
+      }
+      const bool pressed {((keypad >> (V[X] & 0xF)) & 1) != 0};
+      // The loop is left when the skip is taken.
+      return pressed == ((first & 0x00FF) == 0x9E)
+             ? IdleLoop::NONE : IdleLoop::KEY_POLL;
+    }
+    case 0xF007: {
+      const std::uint16_t test {fetch(pc + 2)};
+      if ((test & 0xFF00) != (0x3000 | (X << 8)) || fetch(pc + 4) != jump_back
+          || delay_timer == (test & 0x00FF)) {
+        return IdleLoop::NONE;
+      }
+      return IdleLoop::TIMER_WAIT;
+    }
+  }
+  return IdleLoop::NONE;
+}
+
+/**
+ * FX0A and a jump to self make no progress at all. A key poll cannot succeed
+ * within the run either, as the keypad only changes between runs. A timer
+ * wait only leaves the loop once FX07 reads NN, so every iteration before
+ * that merely stores the delay timer in VX.
+ */
+std::size_t CHIP8::skip_idle(std::size_t budget) {
+  if (waiting_for_key && !(keypad & ~wait_held_keys)) {
+    tick(budget);
+    idle_cycles += budget;
+    return budget;
+  }
+  std::size_t skipped {0};
+  switch (idle_loop()) {
+    case IdleLoop::NONE:
+      return 0;
+    case IdleLoop::JUMP_TO_SELF:
+      skipped = budget;
+      break;
+    case IdleLoop::KEY_POLL:
+      skipped = budget - budget % 2;
+      break;
+    case IdleLoop::TIMER_WAIT: {
+      // Iteration N reads the delay timer after 3 * N cycles. The timer keeps
+      // every value for cycles_per_tick cycles, so with 3 or more an
+      // iteration reads NN once the timer has counted down to it; with fewer
+      // the value may be missed and only the current one is safe to skip.
+      const std::uint16_t test {fetch(pc + 2)};
+      const std::uint8_t NN {static_cast<std::uint8_t>(test & 0x00FF)};
+      std::uint64_t iterations {budget / 3};
+      if (delay_timer > NN) {
+        const std::uint64_t reached {
+          cycles_per_tick >= 3
+          ? tick_countdown
+            + std::uint64_t {delay_timer - NN - 1u} * cycles_per_tick
+          : tick_countdown};
+        iterations = std::min(iterations, (reached + 2) / 3);
+      }
+      if (!iterations) {
+        return 0;
+      }
+      // VX holds whatever the last skipped iteration read.
+      tick(3 * (iterations - 1));
+      V[(test >> 8) & 0xF] = delay_timer;
+      tick(3);
+      idle_cycles += 3 * iterations;
+      return 3 * iterations;
+    }
+  }
+  tick(skipped);
+  idle_cycles += skipped;
+  return skipped;
+}
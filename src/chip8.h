@@ -4,30 +4,166 @@
 #include <cstdint>
 #include <cstddef>
 #include <array>
-#include <vector>
+#include <memory>
 #include <string>
-#include <unordered_map>
+
+#include "instruction.h"
+#include "quirks.h"
+#include "rng.h"
+#include "rom.h"
+#include "snapshot.h"
+#include "translator.h"
+
+// How CHIP8::run executes instructions.
+enum class ExecutionMode {
+  INTERPRETER, // decode and execute one instruction at a time
+  BLOCKS // execute translated basic blocks, see Translator
+};
 
 class CHIP8 {
 public:
+  // Instructions per second executed unless set_clock is called.
+  static constexpr std::uint32_t DEFAULT_CLOCK_HZ {600};
+  // Rate at which the delay and sound timers count down.
+  static constexpr std::uint32_t TIMER_HZ {60};
+
+public:
+  // The state nearly every instruction touches comes first and takes up less
+  // than 64 bytes, so it shares one cache line in a MachineArena, which
+  // aligns every machine to a line. The large arrays follow.
   std::array<std::uint8_t, 16> V; // 16 8-bit data registers
   std::uint16_t pc; // program counter
   std::uint16_t I; // 16-bit index register
-  std::array<std::uint8_t, 4096> mem; // 4096 bytes of addressable memory
   std::uint8_t stack_pointer; // 8-bit stack pointer
-  std::array<std::uint16_t, 16> stack;
-  std::array<std::array<std::uint8_t, 64>, 32> display; // 64x32 pixel display
   std::uint8_t delay_timer;
   std::uint8_t sound_timer;
-  bool redraw;
-  static std::unordered_map<std::int32_t, std::uint8_t> KEYPAD;
+  // FX0A parks the machine until a key that was not already held at the
+  // start of the wait is pressed.
+  bool waiting_for_key;
+  std::uint16_t keypad; // bit N is set while key N is held down
+  std::uint16_t wait_held_keys;
+  // Rows drawn to since the last call to take_changed_rows, bit N for row N.
+  std::uint32_t dirty_rows;
+  // The timers count down once every cycles_per_tick instructions, the next
+  // time after tick_countdown more instructions.
+  std::uint32_t cycles_per_tick;
+  std::uint32_t tick_countdown;
+  std::uint64_t cycles; // number of instructions executed so far
+  ExecutionMode mode;
+  QuirkProfile quirks; // only change through set_quirks
+  std::array<std::uint16_t, 16> stack;
+  std::array<std::uint8_t, 4096> mem; // 4096 bytes of addressable memory
+  // 64x32 pixel display, one row per word with column 0 in the highest bit
+  std::array<std::uint64_t, 32> display;
+  // The display as of the last call to take_changed_rows.
+  std::array<std::uint64_t, 32> presented;
+  // Of the cycles counted above, those that run skipped in idle loops
+  // instead of executing them. Not changed by restore.
+  std::uint64_t idle_cycles;
+  // Unknown operations executed, which do nothing else, and the opcode of
+  // the latest one. Left to the front ends to report. Not changed by
+  // restore.
+  std::uint64_t unknown_operations;
+  std::uint16_t last_unknown_opcode;
+  std::uint64_t rng_seed; // seed last passed to set_seed
+  Pcg32 rng; // draws the numbers of CXNN
+  // Predecoded instructions for 0x200 to 0xFFF, indexed by address - 0x200.
+  // Slots are filled lazily on first execution.
+  std::array<Instruction, 0xE00> icache;
+  Translator translator;
+  // Memory pages shared with the latest snapshot and the pages written since.
+  std::array<std::shared_ptr<const Snapshot::Page>, Snapshot::PAGE_COUNT>
+    snapshot_pages;
+  std::uint16_t dirty_pages;
 
 public:
   CHIP8(const std::string& file_loc);
+  // Loads the ROM with a single copy, the image can be shared by any number
+  // of instances.
+  CHIP8(const RomImage& rom);
   ~CHIP8();
-  static std::vector<std::uint8_t>* read_program(const std::string& file_loc);
+  // Returns the machine to its state right after construction with rom
+  // loaded instead, without allocating. The clock, execution mode, quirk
+  // profile and seed are kept; the random number generator restarts from the
+  // seed, so a recycled machine repeats the run of a fresh one.
+  void reset(const RomImage& rom);
+  std::uint16_t fetch(std::uint16_t address) const;
   void clock_cycle();
-  bool needs_redrawing();
+  // Executes the given number of instructions using the current mode and
+  // returns the number executed. Idle loops are skipped rather than executed
+  // (see idle_cycles), except with a profiler that records instructions.
+  std::size_t run(std::size_t budget);
+  // Same as above, but every interpreted instruction is reported to the
+  // profiler (see profiler.h). Instantiated for NullProfiler and Profiler;
+  // with Profiler every instruction is interpreted, even in BLOCKS mode.
+  template <typename Profiler>
+  void clock_cycle(Profiler& profiler);
+  template <typename Profiler>
+  std::size_t run(std::size_t budget, Profiler& profiler);
+  // Selects the interpreter whose quirks the program expects, see quirks.h.
+  // Drops every predecoded instruction and translated block.
+  void set_quirks(QuirkProfile profile);
+  // Sets the emulated CPU clock. The timers are tied to the number of
+  // instructions executed rather than to wall-clock time, so a run is
+  // deterministic however fast the host executes it.
+  void set_clock(std::uint32_t hz);
+  // Advances the cycle count by count instructions and counts the timers
+  // down accordingly.
+  void tick(std::uint64_t count);
+  // Must be called after the program writes to memory so that predecoded
+  // instructions overlapping [address, address + length) are dropped.
+  void memory_written(std::uint16_t address, std::size_t length);
+  // Returns a random byte and advances the random number generator.
+  std::uint8_t random_byte();
+  // Restarts the random number generator. A run is reproducible from its
+  // seed; instances sharing a seed draw independent numbers if their streams
+  // differ. Every instance starts with a seed taken from the time of day.
+  void set_seed(std::uint64_t seed, std::uint64_t stream);
+  // Captures the whole machine state. Memory pages that have not been written
+  // since the previous snapshot are shared with it instead of being copied.
+  Snapshot snapshot();
+  // Returns the machine to the captured state, only copying the memory pages
+  // that differ from the current ones.
+  void restore(const Snapshot& snapshot);
+  // Returns the rows that differ from the display as of the previous call,
+  // bit N for row N. Rows that were drawn to but ended up unchanged, e.g. a
+  // sprite drawn and erased again within the frame, are left out, so a frame
+  // without any visible change returns 0.
+  std::uint32_t take_changed_rows();
+  bool pixel(std::size_t x, std::size_t y) const;
+  // Updates the keypad state. Input sources call these between runs; the
+  // key operations only ever test the current state and never block.
+  void set_key(std::uint8_t key, bool pressed);
+  void set_keypad(std::uint16_t state);
+  // True if the program can make no further progress without input: it
+  // jumps to itself, waits for a key press, polls a key that is not in the
+  // state it waits for, or waits for a delay timer value that has passed.
+  bool halted() const;
+
+private:
+  // Tight loops that only burn cycles until a timer or the keypad changes.
+  enum class IdleLoop {
+    NONE,
+    JUMP_TO_SELF, // 1NNN to its own address
+    KEY_POLL, // EX9E or EXA1 followed by a jump back, while the key test fails
+    TIMER_WAIT // FX07, 3XNN and a jump back, while the delay timer is not NN
+  };
+
+private:
+  // Copies the fontset and rom into memory, which must be zeroed.
+  void load(const RomImage& rom);
+  // The interpreter loop of each quirk profile, run and clock_cycle pick one
+  // once per call.
+  template <typename Quirks, typename Profiler>
+  void step(Profiler& profiler);
+  template <typename Quirks, typename Profiler>
+  std::size_t interpret(std::size_t budget, Profiler& profiler);
+  // Recognizes the idle loop starting at pc, if any.
+  IdleLoop idle_loop() const;
+  // Runs whole iterations of the idle loop at pc, at most budget cycles, by
+  // advancing the timers directly. The result is identical to interpreting
+  // them. Returns the number of cycles skipped, 0 if pc is not in an idle loop.
+  std::size_t skip_idle(std::size_t budget);
 };
 
 #endif // CHIP8_H
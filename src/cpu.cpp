@@ -1,18 +1,19 @@
 #include "cpu.h"
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
 #include <stdexcept>
 
-#include <SDL2/SDL.h>
 #include "chip8.h"
 
 /**
  *  0NNN      Execute machine language subroutine at address NNN
  */
-void CPU::op_0NNN(CHIP8* chip8, const std::uint16_t& opcode) {
+void CPU::op_0NNN(CHIP8* chip8, const Instruction& ins) {
   // throw std::runtime_error("The operation [0NNN] was not implemented.");
-  const std::uint16_t NNN {opcode & 0x0FFF};
-  chip8->stack[chip8->stack_pointer] = chip8->pc;
+  const std::uint16_t NNN {ins.NNN};
+  chip8->stack[chip8->stack_pointer & 0xF] = chip8->pc;
   ++chip8->stack_pointer;
   chip8->pc = NNN;
 }
@@ -20,32 +21,33 @@ void CPU::op_0NNN(CHIP8* chip8, const std::uint16_t& opcode) {
 /**
  *  00E0      Clear the screen
  */
-void CPU::op_00E0(CHIP8* chip8) {
-  chip8->display = std::array<std::array<std::uint8_t, 64>, 32>{};
-  chip8->redraw = true;
+void CPU::op_00E0(CHIP8* chip8, const Instruction&) {
+  chip8->display.fill(0);
+  chip8->dirty_rows = 0xFFFFFFFF;
 }
 
 /**
  *   00EE     Return from a subroutine
  */
-void CPU::op_00EE(CHIP8* chip8) {
-  chip8->pc = chip8->stack[chip8->stack_pointer--];
+void CPU::op_00EE(CHIP8* chip8, const Instruction&) {
+  --chip8->stack_pointer;
+  chip8->pc = chip8->stack[chip8->stack_pointer & 0xF];
 }
 
 /**
  *   1NNN     Jump to address NNN
  */
-void CPU::op_1NNN(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint16_t NNN {opcode & 0x0FFF};
+void CPU::op_1NNN(CHIP8* chip8, const Instruction& ins) {
+  const std::uint16_t NNN {ins.NNN};
   chip8->pc = NNN;
 }
 
 /**
  *   2NNN     Execute subroutine starting at address NNN
  */
-void CPU::op_2NNN(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint16_t NNN {opcode & 0x0FFF};
-  chip8->stack[chip8->stack_pointer] = chip8->pc;
+void CPU::op_2NNN(CHIP8* chip8, const Instruction& ins) {
+  const std::uint16_t NNN {ins.NNN};
+  chip8->stack[chip8->stack_pointer & 0xF] = chip8->pc;
   ++chip8->stack_pointer;
   chip8->pc = NNN;
 }
@@ -54,9 +56,9 @@ void CPU::op_2NNN(CHIP8* chip8, const std::uint16_t& opcode) {
  *   3XNN     Skip the following instruction if the value of register VX
  *            equals NN
  */
-void CPU::op_3XNN(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
-  const std::uint8_t NN {opcode & 0x00FF};
+void CPU::op_3XNN(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
+  const std::uint8_t NN {ins.NN};
   chip8->pc = chip8->V[X] == NN ? chip8->pc + 2 : chip8->pc;
 }
 
@@ -64,73 +66,73 @@ void CPU::op_3XNN(CHIP8* chip8, const std::uint16_t& opcode) {
  *  4XNN      Skip the following instruction if the value of register VX is not
  *            equal to NN
  */
-void CPU::op_4XNN(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
-  const std::uint8_t NN {opcode & 0x00FF};
+void CPU::op_4XNN(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
+  const std::uint8_t NN {ins.NN};
   chip8->pc = chip8->V[X] != NN ? chip8->pc + 2 : chip8->pc;
 }
 
 /**
- *  5XY0      Skip the following instruction if the value of register VX is equal
- *            to the value of register VY
+ *  5XY0      Skip the following instruction if the value of register VX is
+ *            equal to the value of register VY
  */
-void CPU::op_5XY0(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
-  const std::uint8_t Y {(opcode & 0x00F0) >> 4};
+void CPU::op_5XY0(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
+  const std::uint8_t Y {ins.Y};
   chip8->pc = chip8->V[X] == chip8->V[Y] ? chip8->pc + 2 : chip8->pc;
 }
 
 /**
  *   6XNN     Store number NN in register VX
  */
-void CPU::op_6XNN(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
-  const std::uint8_t NN {opcode & 0x00FF};
+void CPU::op_6XNN(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
+  const std::uint8_t NN {ins.NN};
   chip8->V[X] = NN;
 }
 
 /**
  *   7XNN     Add the value NN to register VX
  */
-void CPU::op_7XNN(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
-  const std::uint8_t NN {opcode & 0x00FF};
+void CPU::op_7XNN(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
+  const std::uint8_t NN {ins.NN};
   chip8->V[X] += NN;
 }
 
 /**
  *   8XY0     Store the value of register VY in register VX
  */
-void CPU::op_8XY0(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
-  const std::uint8_t Y {(opcode & 0x00F0) >> 4};
+void CPU::op_8XY0(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
+  const std::uint8_t Y {ins.Y};
   chip8->V[X] = chip8->V[Y];
 }
 
 /**
  *   8XY1     Set VX to VX OR VY
  */
-void CPU::op_8XY1(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
-  const std::uint8_t Y {(opcode & 0x00F0) >> 4};
+void CPU::op_8XY1(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
+  const std::uint8_t Y {ins.Y};
   chip8->V[X] |= chip8->V[Y];
 }
 
 /**
  *   8XY2     Set VX to VX AND VY
  */
-void CPU::op_8XY2(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
-  const std::uint8_t Y {(opcode & 0x00F0) >> 4};
+void CPU::op_8XY2(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
+  const std::uint8_t Y {ins.Y};
   chip8->V[X] &= chip8->V[Y];
 }
 
 /**
  *   8XY3     Set VX to VX XOR VY
  */
-void CPU::op_8XY3(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
-  const std::uint8_t Y {(opcode & 0x00F0) >> 4};
+void CPU::op_8XY3(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
+  const std::uint8_t Y {ins.Y};
   chip8->V[X] ^= chip8->V[Y];
 }
 
@@ -139,11 +141,13 @@ void CPU::op_8XY3(CHIP8* chip8, const std::uint16_t& opcode) {
  *            Set VF to 01 if a carry occurs
  *            Set VF to 00 if a carry does not occur
  */
-void CPU::op_8XY4(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
-  const std::uint8_t Y {(opcode & 0x00F0) >> 4};
-  chip8->V[0xF] = (chip8->V[Y] + chip8->V[X] > 0xFF);
-  chip8->V[X] += chip8->V[Y];
+void CPU::op_8XY4(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
+  const std::uint8_t Y {ins.Y};
+  const unsigned sum {chip8->V[X] + 0u + chip8->V[Y]};
+  chip8->V[X] = static_cast<std::uint8_t>(sum);
+  // VF is written last so that the flag wins when X is F.
+  chip8->V[0xF] = sum > 0xFF;
 }
 
 /**
@@ -151,23 +155,29 @@ void CPU::op_8XY4(CHIP8* chip8, const std::uint16_t& opcode) {
  *            Set VF to 00 if a borrow occurs
  *            Set VF to 01 if a borrow does not occur
  */
-void CPU::op_8XY5(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
-  const std::uint8_t Y {(opcode & 0x00F0) >> 4};
-  chip8->V[0xF] = (chip8->V[Y] - chip8->V[X] > -1);
-  chip8->V[X] -= chip8->V[Y];
+void CPU::op_8XY5(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
+  const std::uint8_t Y {ins.Y};
+  const std::uint8_t minuend {chip8->V[X]};
+  const std::uint8_t subtrahend {chip8->V[Y]};
+  chip8->V[X] = static_cast<std::uint8_t>(minuend - subtrahend);
+  // VF is written last so that the flag wins when X is F.
+  chip8->V[0xF] = minuend >= subtrahend;
 }
 
 /**
- *  8XY6      Store the value of register VY shifted right one bit in register VX
+ *  8XY6      Store the value of register VY shifted right one bit in
+ *            register VX
  *            Set register VF to the least significant bit prior to the shift
  */
-void CPU::op_8XY6(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
-  const std::uint8_t Y {(opcode & 0x00F0) >> 4};
-  chip8->V[0xF] = chip8->V[Y] & 0x01;
-  chip8->V[Y] >>= 1;
-  chip8->V[X] = chip8->V[Y];
+template <typename Quirks>
+void CPU::op_8XY6(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
+  const std::uint8_t Y {ins.Y};
+  const std::uint8_t value {chip8->V[Quirks::SHIFT_READS_VY ? Y : X]};
+  chip8->V[X] = value >> 1;
+  // VF is written last so that the flag wins when X is F.
+  chip8->V[0xF] = value & 0x01;
 }
 
 /**
@@ -175,169 +185,177 @@ void CPU::op_8XY6(CHIP8* chip8, const std::uint16_t& opcode) {
  *            Set VF to 00 if a borrow occurs
  *            Set VF to 01 if a borrow does not occur
  */
-void CPU::op_8XY7(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
-  const std::uint8_t Y {(opcode & 0x00F0) >> 4};
-  chip8->V[0xF] = (chip8->V[Y] - chip8->V[X] > -1);
-  chip8->V[X] = chip8->V[Y] - chip8->V[X];
+void CPU::op_8XY7(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
+  const std::uint8_t Y {ins.Y};
+  const std::uint8_t minuend {chip8->V[Y]};
+  const std::uint8_t subtrahend {chip8->V[X]};
+  chip8->V[X] = static_cast<std::uint8_t>(minuend - subtrahend);
+  // VF is written last so that the flag wins when X is F.
+  chip8->V[0xF] = minuend >= subtrahend;
 }
 
 /**
  *  8XYE      Store the value of register VY shifted left one bit in register VX
  *            Set register VF to the most significant bit prior to the shift
  */
-void CPU::op_8XYE(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
-  const std::uint8_t Y {(opcode & 0x00F0) >> 4};
-  chip8->V[0xF] = chip8->V[Y] & 0x80;
-  chip8->V[Y] <<= 1;
-  chip8->V[X] = chip8->V[Y];
+template <typename Quirks>
+void CPU::op_8XYE(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
+  const std::uint8_t Y {ins.Y};
+  const std::uint8_t value {chip8->V[Quirks::SHIFT_READS_VY ? Y : X]};
+  chip8->V[X] = static_cast<std::uint8_t>(value << 1);
+  // VF is written last so that the flag wins when X is F.
+  chip8->V[0xF] = value >> 7;
 }
 
 /**
  *  9XY0      Skip the following instruction if the value of register VX is not
  *            equal to the value of register VY
  */
-void CPU::op_9XY0(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
-  const std::uint8_t Y {(opcode & 0x00F0) >> 4};
+void CPU::op_9XY0(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
+  const std::uint8_t Y {ins.Y};
   chip8->pc = (chip8->V[X] != chip8->V[Y]) ? chip8->pc + 2 : chip8->pc;
 }
 
 /**
  *   ANNN     Store memory address NNN in register I
  */
-void CPU::op_ANNN(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint16_t NNN {opcode & 0x0FFF};
+void CPU::op_ANNN(CHIP8* chip8, const Instruction& ins) {
+  const std::uint16_t NNN {ins.NNN};
   chip8->I = NNN;
 }
 
 /**
  *   BNNN     Jump to address NNN + V0
  */
-void CPU::op_BNNN(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint16_t NNN {opcode & 0x0FFF};
-  chip8->pc = NNN + chip8->V[0];
+template <typename Quirks>
+void CPU::op_BNNN(CHIP8* chip8, const Instruction& ins) {
+  const std::uint16_t NNN {ins.NNN};
+  chip8->pc = NNN + chip8->V[Quirks::JUMP_ADDS_VX ? ins.X : 0];
 }
 
 /**
  *   CXNN     Set VX to a random number with a mask of NN
  */
-void CPU::op_CXNN(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
-  const std::uint8_t NN {opcode & 0x00FF};
-  chip8->V[X] = (std::rand() % (1 << 8)) & NN;
+void CPU::op_CXNN(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
+  const std::uint8_t NN {ins.NN};
+  chip8->V[X] = chip8->random_byte() & NN;
 }
 
 /**
  *  DXYN      Draw a sprite at position VX, VY with N bytes of sprite data
  *            starting at the address stored in I
- *            Set VF to 01 if any set pixels are changed to unset, and 00 otherwise
- */
-void CPU::op_DXYN(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
-  const std::uint8_t Y {(opcode & 0x00F0) >> 4};
-  const std::uint8_t N {opcode & 0x000F};
-  for (std::uint8_t byte_idx {0}; byte_idx < N; ++byte_idx) {
-    const std::uint8_t curr_byte {chip8->mem[chip8->I + byte_idx]};
-    for (std::uint8_t pixel_idx {0}; pixel_idx < 8; ++pixel_idx) {
-      const std::uint8_t curr_row {(chip8->V[Y] + byte_idx) % 32};
-      const std::uint8_t curr_col {(chip8->V[X] + pixel_idx) % 64};
-      const std::uint8_t curr_bit {curr_byte & (1 << 7 - pixel_idx) ? 1 : 0};
-      if (chip8->display[curr_row][curr_col] && curr_bit) {
-        chip8->V[0xF] = 0x1;
-      }
-      chip8->display[curr_row][curr_col] ^= curr_bit;
-    }
+ *            Set VF to 01 if any set pixels are changed to unset, and 00
+ *            otherwise
+ */
+template <typename Quirks>
+void CPU::op_DXYN(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
+  const std::uint8_t Y {ins.Y};
+  const std::uint8_t N {ins.N};
+  // The starting position always wraps, only the sprite itself is clipped.
+  const unsigned col {chip8->V[X] & 63u};
+  const unsigned row {chip8->V[Y] & 31u};
+  const unsigned height {Quirks::CLIP_SPRITES && row + N > 32 ? 32 - row : N};
+  std::uint64_t collision {0};
+  std::uint32_t rows {0};
+  for (std::uint8_t byte_idx {0}; byte_idx < height; ++byte_idx) {
+    // Place the sprite byte in columns 0-7, then shift it into position.
+    // Unless clipped, it is rotated so that pixels past the right edge wrap
+    // around to the left.
+    const std::uint64_t curr_byte {
+      static_cast<std::uint64_t>(chip8->mem[(chip8->I + byte_idx) & 0xFFF])
+      << 56};
+    const std::uint64_t sprite {Quirks::CLIP_SPRITES
+      ? curr_byte >> col
+      : (curr_byte >> col) | (curr_byte << ((64 - col) & 63))};
+    std::uint64_t& curr_row {chip8->display[(row + byte_idx) & 31]};
+    collision |= curr_row & sprite;
+    curr_row ^= sprite;
+    rows |= 1u << ((row + byte_idx) & 31);
   }
-  chip8->redraw = true;
+  chip8->V[0xF] = collision ? 0x1 : 0x0;
+  chip8->dirty_rows |= rows;
 }
 
 /**
  *  EX9E      Skip the following instruction if the key corresponding to the
  *            hex value currently stored in register VX is pressed
  */
-void CPU::op_EX9E(CHIP8* chip8, const std::uint16_t& opcode, SDL_Event event) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
-  while (true) {
-    while (SDL_PollEvent(&event)) {
-      const std::int32_t key_pressed {event.key.keysym.sym};
-      if (event.type == SDL_KEYDOWN
-          && chip8->KEYPAD.find(key_pressed) != chip8->KEYPAD.end()) {
-        chip8->pc = chip8->KEYPAD[key_pressed] == chip8->V[X]
-                    ? chip8->pc + 2
-                    : chip8->pc;
-        return;
-      }
-    }
-  }
+void CPU::op_EX9E(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
+  const bool pressed {((chip8->keypad >> (chip8->V[X] & 0xF)) & 1) != 0};
+  chip8->pc = pressed ? chip8->pc + 2 : chip8->pc;
 }
 
 /**
  *  EXA1      Skip the following instruction if the key corresponding to the
  *            hex value currently stored in register VX is not pressed
  */
-void CPU::op_EXA1(CHIP8* chip8, const std::uint16_t& opcode, SDL_Event event) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
-  while (true) {
-    while (SDL_PollEvent(&event)) {
-      const std::int32_t key_pressed {event.key.keysym.sym};
-      if (event.type == SDL_KEYDOWN
-          && chip8->KEYPAD.find(key_pressed) != chip8->KEYPAD.end()) {
-        chip8->pc = chip8->KEYPAD[key_pressed] != chip8->V[X]
-                    ? chip8->pc + 2
-                    : chip8->pc;
-        return;
-      }
-    }
-  }
+void CPU::op_EXA1(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
+  const bool pressed {((chip8->keypad >> (chip8->V[X] & 0xF)) & 1) != 0};
+  chip8->pc = !pressed ? chip8->pc + 2 : chip8->pc;
 }
 
 /**
  *   FX07     Store the current value of the delay timer in register VX
  */
-void CPU::op_FX07(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
+void CPU::op_FX07(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
   chip8->V[X] = chip8->delay_timer;
 }
 
 /**
  *   FX0A     Wait for a keypress and store the result in register VX
  */
-void CPU::op_FX0A(CHIP8* chip8, const std::uint16_t& opcode, SDL_Event event) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
-  while (true) {
-    while (SDL_PollEvent(&event)) {
-      const std::int32_t key_pressed {event.key.keysym.sym};
-      if (event.type == SDL_KEYDOWN) {
-        chip8->V[X] = key_pressed;
-        return;
-      }
-    }
+void CPU::op_FX0A(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
+  if (!chip8->waiting_for_key) {
+    // Keys held when the wait starts only count once released and pressed
+    // again.
+    chip8->wait_held_keys = chip8->keypad;
+  }
+  const std::uint16_t new_keys {
+    static_cast<std::uint16_t>(chip8->keypad & ~chip8->wait_held_keys)};
+  if (!new_keys) {
+    // Park the machine on this instruction until the keypad changes.
+    chip8->waiting_for_key = true;
+    chip8->pc -= 2;
+    return;
+  }
+  std::uint8_t key {0};
+  while (!((new_keys >> key) & 1)) {
+    ++key;
   }
+  chip8->V[X] = key;
+  chip8->waiting_for_key = false;
 }
 
 /**
  *   FX15     Set the delay timer to the value of register VX
  */
-void CPU::op_FX15(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
+void CPU::op_FX15(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
   chip8->delay_timer = chip8->V[X];
 }
 
 /**
  *   FX18     Set the sound timer to the value of register VX
  */
-void CPU::op_FX18(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
+void CPU::op_FX18(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
   chip8->sound_timer = chip8->V[X];
 }
 
 /**
  *   FX1E     Add the value stored in register VX to register I
  */
-void CPU::op_FX1E(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
+void CPU::op_FX1E(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
   chip8->I += chip8->V[X];
 }
 
@@ -345,8 +363,8 @@ void CPU::op_FX1E(CHIP8* chip8, const std::uint16_t& opcode) {
  *  FX29      Set I to the memory address of the sprite data corresponding to
  *            the hexadecimal digit stored in register VX
  */
-void CPU::op_FX29(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
+void CPU::op_FX29(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
   chip8->I = 5 * chip8->V[X];
 }
 
@@ -354,25 +372,28 @@ void CPU::op_FX29(CHIP8* chip8, const std::uint16_t& opcode) {
  *  FX33      Store the binary-coded decimal equivalent of the value stored in
  *            register VX at addresses I, I+1, and I+2
  */
-void CPU::op_FX33(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
+void CPU::op_FX33(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
   const std::uint8_t& value {chip8->V[X]};
-  chip8->mem[chip8->I] = value / 100;
-  chip8->mem[chip8->I + 1] = (value / 10) % 10;
-  chip8->mem[chip8->I + 2] = value % 10;
+  chip8->mem[chip8->I & 0xFFF] = value / 100;
+  chip8->mem[(chip8->I + 1) & 0xFFF] = (value / 10) % 10;
+  chip8->mem[(chip8->I + 2) & 0xFFF] = value % 10;
+  chip8->memory_written(chip8->I, 3);
 }
 
 /**
- *  FX55      Store the values of registers V0 to VX inclusive in memory starting
+ *  FX55      Store the values of registers V0 to VX inclusive in memory
+ *            starting at address I
  *            I is set to I + X + 1 after operation
- *            at address I
  */
-void CPU::op_FX55(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
+template <typename Quirks>
+void CPU::op_FX55(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
   for (std::uint8_t idx {0x000}; idx <= X; ++idx) {
-    chip8->mem[chip8->I + idx] = chip8->V[idx];
+    chip8->mem[(chip8->I + idx) & 0xFFF] = chip8->V[idx];
   }
-  chip8->I += X + 1;
+  chip8->memory_written(chip8->I, X + 1);
+  chip8->I = Quirks::index_after_load_store(chip8->I, X);
 }
 
 /**
@@ -380,10 +401,143 @@ void CPU::op_FX55(CHIP8* chip8, const std::uint16_t& opcode) {
  *            starting at address I
  *            I is set to I + X + 1 after operation
  */
-void CPU::op_FX65(CHIP8* chip8, const std::uint16_t& opcode) {
-  const std::uint8_t X {(opcode & 0x0F00) >> 8};
+template <typename Quirks>
+void CPU::op_FX65(CHIP8* chip8, const Instruction& ins) {
+  const std::uint8_t X {ins.X};
   for (std::uint8_t idx {0x000}; idx <= X; ++idx) {
-    chip8->V[idx] = chip8->mem[chip8->I + idx];
+    chip8->V[idx] = chip8->mem[(chip8->I + idx) & 0xFFF];
+  }
+  chip8->I = Quirks::index_after_load_store(chip8->I, X);
+}
+
+/**
+ *   ????     Any opcode not listed above
+ */
+void CPU::op_unknown(CHIP8* chip8, const Instruction& ins) {
+  ++chip8->unknown_operations;
+  chip8->last_unknown_opcode = ins.opcode;
+}
+
+namespace {
+/*
+ * Maps an opcode onto its handler. This is only consulted while building the
+ * dispatch tables, so the nested switches never run on the hot path.
+ */
+template <typename Quirks>
+CPU::Handler select_handler(const std::uint16_t opcode) {
+  switch (opcode & 0xF000) {
+    case 0x0000:
+      switch (opcode) {
+        case 0x00E0: return &CPU::op_00E0;
+        case 0x00EE: return &CPU::op_00EE;
+        default: return &CPU::op_0NNN;
+      }
+    case 0x1000: return &CPU::op_1NNN;
+    case 0x2000: return &CPU::op_2NNN;
+    case 0x3000: return &CPU::op_3XNN;
+    case 0x4000: return &CPU::op_4XNN;
+    case 0x5000:
+      return (opcode & 0x000F) == 0x0 ? &CPU::op_5XY0 : &CPU::op_unknown;
+    case 0x6000: return &CPU::op_6XNN;
+    case 0x7000: return &CPU::op_7XNN;
+    case 0x8000:
+      switch (opcode & 0x000F) {
+        case 0x0: return &CPU::op_8XY0;
+        case 0x1: return &CPU::op_8XY1;
+        case 0x2: return &CPU::op_8XY2;
+        case 0x3: return &CPU::op_8XY3;
+        case 0x4: return &CPU::op_8XY4;
+        case 0x5: return &CPU::op_8XY5;
+        case 0x6: return &CPU::op_8XY6<Quirks>;
+        case 0x7: return &CPU::op_8XY7;
+        case 0xE: return &CPU::op_8XYE<Quirks>;
+        default: return &CPU::op_unknown;
+      }
+    case 0x9000:
+      return (opcode & 0x000F) == 0x0 ? &CPU::op_9XY0 : &CPU::op_unknown;
+    case 0xA000: return &CPU::op_ANNN;
+    case 0xB000: return &CPU::op_BNNN<Quirks>;
+    case 0xC000: return &CPU::op_CXNN;
+    case 0xD000: return &CPU::op_DXYN<Quirks>;
+    case 0xE000:
+      switch (opcode & 0x00FF) {
+        case 0x9E: return &CPU::op_EX9E;
+        case 0xA1: return &CPU::op_EXA1;
+        default: return &CPU::op_unknown;
+      }
+    case 0xF000:
+      switch (opcode & 0x00FF) {
+        case 0x07: return &CPU::op_FX07;
+        case 0x0A: return &CPU::op_FX0A;
+        case 0x15: return &CPU::op_FX15;
+        case 0x18: return &CPU::op_FX18;
+        case 0x1E: return &CPU::op_FX1E;
+        case 0x29: return &CPU::op_FX29;
+        case 0x33: return &CPU::op_FX33;
+        case 0x55: return &CPU::op_FX55<Quirks>;
+        case 0x65: return &CPU::op_FX65<Quirks>;
+        default: return &CPU::op_unknown;
+      }
   }
-  chip8->I += X + 1;
+  return &CPU::op_unknown;
 }
+
+/*
+ * The handler of every opcode under one quirk profile. Each table takes
+ * 512 KiB, so it is only built once the profile decodes its first opcode.
+ */
+template <typename Quirks>
+struct DispatchTable {
+  DispatchTable() : handlers {} {
+    for (std::size_t opcode {0}; opcode < handlers.size(); ++opcode) {
+      handlers[opcode] =
+        select_handler<Quirks>(static_cast<std::uint16_t>(opcode));
+    }
+  }
+
+  std::array<CPU::Handler, 0x10000> handlers;
+};
+
+template <typename Quirks>
+const DispatchTable<Quirks>& dispatch_table() {
+  static const DispatchTable<Quirks> table {};
+  return table;
+}
+} // namespace
+
+template <typename Quirks>
+Instruction CPU::decode(std::uint16_t opcode) {
+  return Instruction {
+    ::dispatch_table<Quirks>().handlers[opcode],
+    opcode,
+    static_cast<std::uint16_t>(opcode & 0x0FFF),
+    static_cast<std::uint8_t>((opcode & 0x0F00) >> 8),
+    static_cast<std::uint8_t>((opcode & 0x00F0) >> 4),
+    static_cast<std::uint8_t>(opcode & 0x000F),
+    static_cast<std::uint8_t>(opcode & 0x00FF)
+  };
+}
+
+Instruction CPU::decode(std::uint16_t opcode, QuirkProfile profile) {
+  switch (profile) {
+    case QuirkProfile::CHIP48: return decode<Chip48Quirks>(opcode);
+    case QuirkProfile::SUPER_CHIP: return decode<SuperChipQuirks>(opcode);
+    case QuirkProfile::CHIP8: break;
+  }
+  return decode<Chip8Quirks>(opcode);
+}
+
+#define CHIP8_INSTANTIATE_QUIRKS(Quirks) \
+  template Instruction CPU::decode<Quirks>(std::uint16_t); \
+  template void CPU::op_8XY6<Quirks>(CHIP8*, const Instruction&); \
+  template void CPU::op_8XYE<Quirks>(CHIP8*, const Instruction&); \
+  template void CPU::op_BNNN<Quirks>(CHIP8*, const Instruction&); \
+  template void CPU::op_DXYN<Quirks>(CHIP8*, const Instruction&); \
+  template void CPU::op_FX55<Quirks>(CHIP8*, const Instruction&); \
+  template void CPU::op_FX65<Quirks>(CHIP8*, const Instruction&);
+
+CHIP8_INSTANTIATE_QUIRKS(Chip8Quirks)
+CHIP8_INSTANTIATE_QUIRKS(Chip48Quirks)
+CHIP8_INSTANTIATE_QUIRKS(SuperChipQuirks)
+
+#undef CHIP8_INSTANTIATE_QUIRKS
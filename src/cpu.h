@@ -3,137 +3,169 @@
 
 #include <cstdint>
 
-#include <SDL2/SDL.h>
-
 #include "chip8.h"
+#include "instruction.h"
+#include "quirks.h"
 
 class CPU {
 public:
+  // Every operation shares this signature so it can be stored in the dispatch
+  // table and invoked through a single indirect call.
+  using Handler = Instruction::Handler;
+
+  // Extracts the operand fields of the given opcode and pairs them with its
+  // handler. The handler lookup is a single indexed load from a table
+  // covering all 64K opcodes, built the first time a quirk profile is used.
+  // Instantiated for the policies in quirks.h.
+  template <typename Quirks>
+  static Instruction decode(std::uint16_t opcode);
+  // Same as above for a profile only known at runtime.
+  static Instruction decode(std::uint16_t opcode, QuirkProfile profile);
+
   // 0NNN     Execute machine language subroutine at address NNN
-  static void op_0NNN(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_0NNN(CHIP8* chip8, const Instruction& ins);
 
   // 00E0     Clear the screen
-  static void op_00E0(CHIP8* chip);
+  static void op_00E0(CHIP8* chip8, const Instruction& ins);
 
   // 00EE     Return from a subroutine
-  static void op_00EE(CHIP8* chip);
+  static void op_00EE(CHIP8* chip8, const Instruction& ins);
 
   // 1NNN     Jump to address NNN
-  static void op_1NNN(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_1NNN(CHIP8* chip8, const Instruction& ins);
 
   // 2NNN     Execute subroutine starting at address NNN
-  static void op_2NNN(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_2NNN(CHIP8* chip8, const Instruction& ins);
 
-  // 3XNN     Skip the following instruction if the value of register VX equals NN
-  static void op_3XNN(CHIP8* chip8, const std::uint16_t& opcode);
+  // 3XNN     Skip the following instruction if the value of register VX
+  //          equals NN
+  static void op_3XNN(CHIP8* chip8, const Instruction& ins);
 
   // 4XNN     Skip the following instruction if the value of register VX is not
   //          equal to NN
-  static void op_4XNN(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_4XNN(CHIP8* chip8, const Instruction& ins);
 
-  // 5XY0     Skip the following instruction if the value of register VX is equal
-  //          to the value of register VY
-  static void op_5XY0(CHIP8* chip8, const std::uint16_t& opcode);
+  // 5XY0     Skip the following instruction if the value of register VX is
+  //          equal to the value of register VY
+  static void op_5XY0(CHIP8* chip8, const Instruction& ins);
 
   // 6XNN     Store number NN in register VX
-  static void op_6XNN(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_6XNN(CHIP8* chip8, const Instruction& ins);
 
   // 7XNN     Add the value NN to register VX
-  static void op_7XNN(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_7XNN(CHIP8* chip8, const Instruction& ins);
 
   // 8XY0     Store the value of register VY in register VX
-  static void op_8XY0(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_8XY0(CHIP8* chip8, const Instruction& ins);
 
   // 8XY1     Set VX to VX OR VY
-  static void op_8XY1(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_8XY1(CHIP8* chip8, const Instruction& ins);
 
   // 8XY2     Set VX to VX AND VY
-  static void op_8XY2(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_8XY2(CHIP8* chip8, const Instruction& ins);
 
   // 8XY3     Set VX to VX XOR VY
-  static void op_8XY3(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_8XY3(CHIP8* chip8, const Instruction& ins);
 
   // 8XY4     Add the value of register VY to register VX
   //          Set VF to 01 if a carry occurs
   //          Set VF to 00 if a carry does not occur
-  static void op_8XY4(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_8XY4(CHIP8* chip8, const Instruction& ins);
 
   // 8XY5     Subtract the value of register VY from register VX
   //          Set VF to 00 if a borrow occurs
   //          Set VF to 01 if a borrow does not occur
-  static void op_8XY5(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_8XY5(CHIP8* chip8, const Instruction& ins);
 
-  // 8XY6     Store the value of register VY shifted right one bit in register VX
+  // 8XY6     Store the value of register VY shifted right one bit in
+  //          register VX
   //          Set register VF to the least significant bit prior to the shift
-  static void op_8XY6(CHIP8* chip8, const std::uint16_t& opcode);
+  //          (CHIP-48, SUPER-CHIP: shift VX itself, VY is ignored)
+  template <typename Quirks>
+  static void op_8XY6(CHIP8* chip8, const Instruction& ins);
 
   // 8XY7     Set register VX to the value of VY minus VX
   //          Set VF to 00 if a borrow occurs
   //          Set VF to 01 if a borrow does not occur
-  static void op_8XY7(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_8XY7(CHIP8* chip8, const Instruction& ins);
 
   // 8XYE     Store the value of register VY shifted left one bit in register VX
   //          Set register VF to the most significant bit prior to the shift
-  static void op_8XYE(CHIP8* chip8, const std::uint16_t& opcode);
+  //          (CHIP-48, SUPER-CHIP: shift VX itself, VY is ignored)
+  template <typename Quirks>
+  static void op_8XYE(CHIP8* chip8, const Instruction& ins);
 
   // 9XY0     Skip the following instruction if the value of register VX is not
   //          equal to the value of register VY
-  static void op_9XY0(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_9XY0(CHIP8* chip8, const Instruction& ins);
 
   // ANNN     Store memory address NNN in register I
-  static void op_ANNN(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_ANNN(CHIP8* chip8, const Instruction& ins);
 
   // BNNN     Jump to address NNN + V0
-  static void op_BNNN(CHIP8* chip8, const std::uint16_t& opcode);
+  //          (CHIP-48, SUPER-CHIP: jump to address XNN + VX)
+  template <typename Quirks>
+  static void op_BNNN(CHIP8* chip8, const Instruction& ins);
 
   // CXNN     Set VX to a random number with a mask of NN
-  static void op_CXNN(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_CXNN(CHIP8* chip8, const Instruction& ins);
 
   // DXYN     Draw a sprite at position VX, VY with N bytes of sprite data
   //          starting at the address stored in I
-  //          Set VF to 01 if any set pixels are changed to unset, and 00 otherwise
-  static void op_DXYN(CHIP8* chip8, const std::uint16_t& opcode);
+  //          Set VF to 01 if any set pixels are changed to unset, and 00
+  //          otherwise
+  //          (CHIP-48, SUPER-CHIP: pixels past the edges are clipped instead
+  //          of wrapping around)
+  template <typename Quirks>
+  static void op_DXYN(CHIP8* chip8, const Instruction& ins);
 
   // EX9E     Skip the following instruction if the key corresponding to the
   //          hex value currently stored in register VX is pressed
-  static void op_EX9E(CHIP8* chip8, const std::uint16_t& opcode, SDL_Event event);
+  static void op_EX9E(CHIP8* chip8, const Instruction& ins);
 
   // EXA1     Skip the following instruction if the key corresponding to the
   //          hex value currently stored in register VX is not pressed
-  static void op_EXA1(CHIP8* chip8, const std::uint16_t& opcode, SDL_Event event);
+  static void op_EXA1(CHIP8* chip8, const Instruction& ins);
 
   // FX07     Store the current value of the delay timer in register VX
-  static void op_FX07(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_FX07(CHIP8* chip8, const Instruction& ins);
 
   // FX0A     Wait for a keypress and store the result in register VX
-  static void op_FX0A(CHIP8* chip8, const std::uint16_t& opcode, SDL_Event event);
+  static void op_FX0A(CHIP8* chip8, const Instruction& ins);
 
   // FX15     Set the delay timer to the value of register VX
-  static void op_FX15(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_FX15(CHIP8* chip8, const Instruction& ins);
 
   // FX18     Set the sound timer to the value of register VX
-  static void op_FX18(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_FX18(CHIP8* chip8, const Instruction& ins);
 
   // FX1E     Add the value stored in register VX to register I
-  static void op_FX1E(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_FX1E(CHIP8* chip8, const Instruction& ins);
 
-  // FX29     Set I to the memory address of the sprite data corresponding to the
-  //          hexadecimal digit stored in register VX
-  static void op_FX29(CHIP8* chip8, const std::uint16_t& opcode);
+  // FX29     Set I to the memory address of the sprite data corresponding to
+  //          the hexadecimal digit stored in register VX
+  static void op_FX29(CHIP8* chip8, const Instruction& ins);
 
   // FX33     Store the binary-coded decimal equivalent of the value stored in
   //          register VX at addresses I, I+1, and I+2
-  static void op_FX33(CHIP8* chip8, const std::uint16_t& opcode);
+  static void op_FX33(CHIP8* chip8, const Instruction& ins);
 
-  // FX55     Store the values of registers V0 to VX inclusive in memory starting
-  //          at address I
+  // FX55     Store the values of registers V0 to VX inclusive in memory
+  //          starting at address I
   //          I is set to I + X + 1 after operation
-  static void op_FX55(CHIP8* chip8, const std::uint16_t& opcode);
+  //          (CHIP-48: I + X, SUPER-CHIP: I is left unchanged)
+  template <typename Quirks>
+  static void op_FX55(CHIP8* chip8, const Instruction& ins);
 
   // FX65     Fill registers V0 to VX inclusive with the values stored in memory
   //          starting at address I
   //          I is set to I + X + 1 after operation
-  static void op_FX65(CHIP8* chip8, const std::uint16_t& opcode);
+  //          (CHIP-48: I + X, SUPER-CHIP: I is left unchanged)
+  template <typename Quirks>
+  static void op_FX65(CHIP8* chip8, const Instruction& ins);
+
+  // ????     Any opcode not listed above
+  static void op_unknown(CHIP8* chip8, const Instruction& ins);
 };
 
 #endif // CPU_H
@@ -0,0 +1,346 @@
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "analyzer.h"
+#include "arena.h"
+#include "batch.h"
+#include "capture.h"
+#include "chip8.h"
+#include "input_log.h"
+#include "pool.h"
+#include "profiler.h"
+#include "quirks.h"
+#include "rom.h"
+#include "snapshot.h"
+#include "translator.h"
+
+namespace {
+// Instructions executed between two checks for a halted program.
+constexpr std::size_t CYCLES_PER_CHECK {1024};
+// Instructions executed when no cycle limit was given.
+constexpr std::uint64_t DEFAULT_CYCLES {10000000};
+// Instructions an instance runs before the pool hands out the next one.
+constexpr std::uint64_t POOL_SLICE_CYCLES {100000};
+// Entries listed per table of the profiling report.
+constexpr std::size_t PROFILE_TOP {20};
+
+void dump_state(const CHIP8& chip8, std::ostream& out) {
+  out << std::hex << std::uppercase << std::setfill('0');
+  for (std::size_t idx {0}; idx < chip8.V.size(); ++idx) {
+    out << 'V' << idx << '=' << std::setw(2) << +chip8.V[idx]
+        << (idx % 8 == 7 ? '\n' : ' ');
+  }
+  out << "I=" << std::setw(3) << chip8.I << " pc=" << std::setw(3) << chip8.pc
+      << " sp=" << +chip8.stack_pointer
+      << " DT=" << std::setw(2) << +chip8.delay_timer
+      << " ST=" << std::setw(2) << +chip8.sound_timer << '\n'
+      << std::dec << "cycles=" << chip8.cycles << '\n';
+  for (std::size_t row {0}; row < 32; ++row) {
+    for (std::size_t col {0}; col < 64; ++col) {
+      out << (chip8.pixel(col, row) ? '#' : '.');
+    }
+    out << '\n';
+  }
+}
+
+// The machine only counts the unknown operations it runs into.
+void report_unknown_operations(const CHIP8& chip8, std::ostream& out) {
+  if (chip8.unknown_operations) {
+    out << "Warning: " << chip8.unknown_operations
+        << " unknown operations executed, the last one " << std::hex
+        << std::uppercase << std::setw(4) << std::setfill('0')
+        << chip8.last_unknown_opcode << std::dec << ".\n";
+  }
+}
+
+/*
+ * Runs chip8 up to the given cycle count, reporting every instruction to the
+ * profiler if there is one. With a recorder, the run stops at the end of
+ * every 60 Hz frame to hand it the display.
+ */
+void run_until(CHIP8& chip8, std::uint64_t target, Profiler* profiler,
+               FrameRecorder* recorder) {
+  while (chip8.cycles < target) {
+    const std::uint64_t remaining {target - chip8.cycles};
+    const std::uint64_t limit {
+      recorder ? chip8.tick_countdown : CYCLES_PER_CHECK};
+    const std::size_t slice {remaining < limit ? remaining : limit};
+    if (profiler) {
+      chip8.run(slice, *profiler);
+    } else {
+      chip8.run(slice);
+    }
+    if (recorder && chip8.tick_countdown == chip8.cycles_per_tick) {
+      recorder->capture(chip8, chip8.take_changed_rows());
+    }
+  }
+}
+
+template <std::size_t Lanes>
+void run_batch(const RomImage& rom, QuirkProfile quirks, std::uint32_t clock_hz,
+               std::uint64_t seed, std::uint64_t cycles, std::ostream& out) {
+  LockstepBatch<Lanes> batch {rom};
+  for (std::size_t lane_idx {0}; lane_idx < Lanes; ++lane_idx) {
+    CHIP8& lane {batch.lane(lane_idx)};
+    lane.set_quirks(quirks);
+    lane.set_clock(clock_hz);
+    // One seed for the whole batch, a separate stream for every lane, the
+    // same as the instances of a pool.
+    lane.set_seed(seed, lane_idx);
+  }
+  const auto start {std::chrono::steady_clock::now()};
+  batch.run(cycles);
+  const std::chrono::duration<double> elapsed {
+    std::chrono::steady_clock::now() - start};
+  out << Lanes << " lanes: " << batch.lockstep_steps() << " lockstep steps, "
+      << batch.scalar_steps() << " scalar steps, "
+      << Lanes * cycles / elapsed.count() << " instructions/s\n";
+  dump_state(batch.lane(0), out);
+}
+} // namespace
+
+/*
+ * Runs a ROM without any display or input attached, then dumps the final
+ * registers and framebuffer to stdout.
+ */
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    std::cout << "Missing filename. (e.g. \"./chip8-headless <$ROM_PATH> "
+              << "[--cycles N] [--blocks] [--verify] [--instances N] "
+              << "[--threads N] [--lanes 8|16|32] [--load SNAPSHOT] "
+              << "[--save SNAPSHOT] [--clock HZ] [--replay INPUT_LOG] "
+              << "[--profile FOLDED_STACKS] [--quirks chip8|chip48|schip] "
+              << "[--capture FRAME_CAPTURE] [--lossless] [--analyze] "
+              << "[--strict] [--seed N]\")\n";
+    return 1;
+  }
+  const std::string file_location {argv[1]};
+  std::uint64_t max_cycles {DEFAULT_CYCLES};
+  ExecutionMode mode {ExecutionMode::INTERPRETER};
+  bool verify {false};
+  std::size_t instances {1};
+  std::size_t threads {0};
+  std::size_t lanes {0};
+  std::string load_path {};
+  std::string save_path {};
+  std::uint32_t clock_hz {CHIP8::DEFAULT_CLOCK_HZ};
+  std::string replay_path {};
+  std::string profile_path {};
+  std::string quirks_name {"chip8"};
+  std::string capture_path {};
+  bool lossless {false};
+  bool analyze {false};
+  bool strict {false};
+  std::uint64_t seed {static_cast<std::uint64_t>(std::time(nullptr))};
+  for (int arg_idx {2}; arg_idx < argc; ++arg_idx) {
+    const std::string option {argv[arg_idx]};
+    if (option == "--cycles" && arg_idx + 1 < argc) {
+      max_cycles = std::strtoull(argv[++arg_idx], nullptr, 10);
+    } else if (option == "--blocks") {
+      mode = ExecutionMode::BLOCKS;
+    } else if (option == "--verify") {
+      verify = true;
+    } else if (option == "--instances" && arg_idx + 1 < argc) {
+      instances = std::strtoul(argv[++arg_idx], nullptr, 10);
+    } else if (option == "--threads" && arg_idx + 1 < argc) {
+      threads = std::strtoul(argv[++arg_idx], nullptr, 10);
+    } else if (option == "--lanes" && arg_idx + 1 < argc) {
+      lanes = std::strtoul(argv[++arg_idx], nullptr, 10);
+    } else if (option == "--load" && arg_idx + 1 < argc) {
+      load_path = argv[++arg_idx];
+    } else if (option == "--save" && arg_idx + 1 < argc) {
+      save_path = argv[++arg_idx];
+    } else if (option == "--clock" && arg_idx + 1 < argc) {
+      clock_hz = std::strtoul(argv[++arg_idx], nullptr, 10);
+    } else if (option == "--replay" && arg_idx + 1 < argc) {
+      replay_path = argv[++arg_idx];
+    } else if (option == "--profile" && arg_idx + 1 < argc) {
+      // Report the hot spots and write the call stacks for flamegraph.pl.
+      profile_path = argv[++arg_idx];
+    } else if (option == "--quirks" && arg_idx + 1 < argc) {
+      // Follow the interpreter the ROM was written for.
+      quirks_name = argv[++arg_idx];
+    } else if (option == "--capture" && arg_idx + 1 < argc) {
+      // Log every changed frame, see chip8-capture-png.
+      capture_path = argv[++arg_idx];
+    } else if (option == "--lossless") {
+      // Stall the emulator rather than drop frames the writer can't keep up
+      // with.
+      lossless = true;
+    } else if (option == "--analyze") {
+      // Disassemble the reachable code instead of running it.
+      analyze = true;
+    } else if (option == "--strict") {
+      // Refuse to run a ROM the analyzer found problems in.
+      strict = true;
+    } else if (option == "--seed" && arg_idx + 1 < argc) {
+      // Draw the same random numbers as an earlier run.
+      seed = std::strtoull(argv[++arg_idx], nullptr, 10);
+    } else {
+      std::cerr << "Unknown option: " << option << '\n';
+      return 1;
+    }
+  }
+  // A pool or batch only reports throughput, these need a single machine.
+  if ((instances > 1 || lanes)
+      && (!profile_path.empty() || !capture_path.empty()
+          || !replay_path.empty() || !load_path.empty()
+          || !save_path.empty())) {
+    std::cerr << "--profile, --capture, --replay, --load and --save run a "
+              << "single machine and cannot be combined with --instances "
+              << "or --lanes.\n";
+    return 1;
+  }
+  try {
+    const QuirkProfile quirks {parse_quirk_profile(quirks_name)};
+    if (verify) {
+      return verify_translation(file_location, quirks, max_cycles, std::cerr)
+             ? 0 : 1;
+    }
+    // Read the ROM once, every instance loads it from this image.
+    const RomImage rom {file_location};
+    CHIP8 loaded {rom};
+    loaded.set_quirks(quirks);
+    const Analysis analysis {loaded};
+    if (analyze) {
+      analysis.write_listing(loaded, std::cout);
+      return analysis.problems.empty() ? 0 : 1;
+    }
+    // The analysis follows both arms of every skip and the fall-through of
+    // every call, so a valid ROM may still be reported. Only refuse to run
+    // it when asked to.
+    for (const std::string& problem : analysis.problems) {
+      std::cerr << "Warning: " << problem << '\n';
+    }
+    if (strict && !analysis.problems.empty()) {
+      throw std::runtime_error("The ROM failed static analysis.");
+    }
+    if (lanes) {
+      // Run copies of the ROM in lockstep and dump the first lane.
+      switch (lanes) {
+        case 8:
+          run_batch<8>(rom, quirks, clock_hz, seed, max_cycles, std::cout);
+          break;
+        case 16:
+          run_batch<16>(rom, quirks, clock_hz, seed, max_cycles, std::cout);
+          break;
+        case 32:
+          run_batch<32>(rom, quirks, clock_hz, seed, max_cycles, std::cout);
+          break;
+        default:
+          std::cerr << "A batch runs 8, 16 or 32 lanes.\n";
+          return 1;
+      }
+      return 0;
+    }
+    if (instances > 1) {
+      // Run independent copies of the ROM on every core and report the
+      // throughput instead of the final state.
+      // One allocation holds every instance.
+      MachineArena arena {instances};
+      EmulatorPool pool {threads, POOL_SLICE_CYCLES};
+      for (std::size_t idx {0}; idx < instances; ++idx) {
+        CHIP8* chip8 {arena.acquire(rom)};
+        chip8->mode = mode;
+        chip8->set_clock(clock_hz);
+        chip8->set_quirks(quirks);
+        // One seed for the whole pool, a separate stream for every instance.
+        chip8->set_seed(seed, idx);
+        analysis.warm_up(*chip8);
+        pool.add(*chip8, max_cycles);
+      }
+      pool.run();
+      pool.report(std::cout);
+      return 0;
+    }
+    CHIP8 chip8 {rom};
+    chip8.mode = mode;
+    chip8.set_clock(clock_hz);
+    chip8.set_quirks(quirks);
+    chip8.set_seed(seed, 0);
+    analysis.warm_up(chip8);
+    if (!load_path.empty()) {
+      std::ifstream in {load_path, std::ios::binary};
+      if (!in) {
+        throw std::runtime_error("Snapshot could not be found.");
+      }
+      chip8.restore(Snapshot::deserialize(std::vector<std::uint8_t>{
+        std::istreambuf_iterator<char>{in}, {}}));
+    }
+    std::unique_ptr<Profiler> profiler {};
+    if (!profile_path.empty()) {
+      profiler.reset(new Profiler {});
+    }
+    std::ofstream capture_file {};
+    std::unique_ptr<FrameRecorder> recorder {};
+    if (!capture_path.empty()) {
+      capture_file.open(capture_path, std::ios::binary);
+      if (!capture_file) {
+        throw std::runtime_error("Capture could not be created.");
+      }
+      recorder.reset(new FrameRecorder {capture_file, chip8, lossless});
+    }
+    if (!replay_path.empty()) {
+      // Feed the recorded key presses back, then carry on as usual.
+      std::ifstream in {replay_path, std::ios::binary};
+      if (!in) {
+        throw std::runtime_error("Input log could not be found.");
+      }
+      InputReplayer replayer {in};
+      replayer.prepare(chip8, rom);
+      while (replayer.next()) {
+        ::run_until(chip8, replayer.due(), profiler.get(), recorder.get());
+        replayer.apply(chip8);
+      }
+      if (replayer.desynced()) {
+        std::cerr << "The replay diverged from the recorded run.\n";
+      }
+    }
+    while (chip8.cycles < max_cycles && !chip8.halted()) {
+      const std::uint64_t remaining {max_cycles - chip8.cycles};
+      ::run_until(chip8,
+                  chip8.cycles + (remaining < CYCLES_PER_CHECK
+                                  ? remaining : CYCLES_PER_CHECK),
+                  profiler.get(), recorder.get());
+    }
+    if (recorder && recorder->dropped()) {
+      std::cerr << "The capture dropped " << recorder->dropped()
+                << " frames the writer could not keep up with, pass "
+                << "--lossless to keep them.\n";
+    }
+    ::report_unknown_operations(chip8, std::cerr);
+    // Writes the remaining frames before the state is dumped.
+    recorder.reset();
+    std::cout << (chip8.halted() ? "halted" : "cycle limit reached") << '\n';
+    dump_state(chip8, std::cout);
+    if (profiler) {
+      std::cout << '\n';
+      profiler->report(std::cout, PROFILE_TOP);
+      std::ofstream out {profile_path};
+      profiler->write_folded(out);
+    }
+    if (!save_path.empty()) {
+      const std::vector<std::uint8_t> data {chip8.snapshot().serialize()};
+      std::ofstream out {save_path, std::ios::binary};
+      out.write(reinterpret_cast<const char*>(data.data()),
+                static_cast<std::streamsize>(data.size()));
+    }
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
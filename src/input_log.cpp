@@ -0,0 +1,187 @@
+#include "input_log.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+
+#include "chip8.h"
+#include "quirks.h"
+#include "rom.h"
+
+namespace {
+constexpr std::array<char, 4> MAGIC {'C', '8', 'I', 'L'};
+constexpr std::uint8_t VERSION {4};
+
+// 64-bit FNV-1a, enough to tell ROMs apart.
+std::uint64_t hash_rom(const RomImage& rom) {
+  std::uint64_t hash {0xCBF29CE484222325};
+  for (std::size_t idx {0}; idx < rom.size(); ++idx) {
+    hash = (hash ^ rom.data()[idx]) * 0x100000001B3;
+  }
+  return hash;
+}
+
+template <typename T>
+void put(std::ostream& out, T value) {
+  for (std::size_t byte {0}; byte < sizeof(T); ++byte) {
+    out.put(static_cast<char>(value >> (8 * byte)));
+  }
+}
+
+void put_varint(std::ostream& out, std::uint64_t value) {
+  while (value >= 0x80) {
+    out.put(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out.put(static_cast<char>(value));
+}
+
+// Returns false if the stream ended before the first byte.
+template <typename T>
+bool get(std::istream& in, T& value) {
+  value = 0;
+  for (std::size_t byte {0}; byte < sizeof(T); ++byte) {
+    const int next {in.get()};
+    if (next == std::istream::traits_type::eof()) {
+      if (byte == 0) {
+        return false;
+      }
+      throw std::invalid_argument("The input log is truncated.");
+    }
+    value |= static_cast<T>(static_cast<T>(next & 0xFF) << (8 * byte));
+  }
+  return true;
+}
+
+bool get_varint(std::istream& in, std::uint64_t& value) {
+  value = 0;
+  for (unsigned shift {0}; shift < 64; shift += 7) {
+    const int next {in.get()};
+    if (next == std::istream::traits_type::eof()) {
+      if (shift == 0) {
+        return false;
+      }
+      throw std::invalid_argument("The input log is truncated.");
+    }
+    value |= static_cast<std::uint64_t>(next & 0x7F) << shift;
+    if (!(next & 0x80)) {
+      return true;
+    }
+  }
+  throw std::invalid_argument("The input log contains an invalid record.");
+}
+} // namespace
+
+InputRecorder::InputRecorder(std::ostream& stream, const CHIP8& chip8,
+                             const RomImage& rom)
+  : out {stream}, last_cycle {chip8.cycles}, last_keypad {chip8.keypad} {
+  if (chip8.cycles != 0) {
+    throw std::invalid_argument("Only a freshly loaded machine can be "
+                                "recorded.");
+  }
+  out.write(MAGIC.data(), MAGIC.size());
+  put(out, VERSION);
+  put(out, static_cast<std::uint8_t>(chip8.quirks));
+  put(out, static_cast<std::uint32_t>(rom.size()));
+  put(out, ::hash_rom(rom));
+  put(out, chip8.rng_seed);
+  put(out, chip8.rng.stream());
+  put(out, chip8.cycles_per_tick);
+}
+
+void InputRecorder::record(const CHIP8& chip8) {
+  if (chip8.keypad == last_keypad) {
+    return;
+  }
+  put_varint(out, chip8.cycles - last_cycle);
+  put(out, static_cast<std::uint16_t>(chip8.keypad ^ last_keypad));
+  put(out, chip8.rng.state);
+  last_cycle = chip8.cycles;
+  last_keypad = chip8.keypad;
+}
+
+InputReplayer::InputReplayer(std::istream& stream)
+  : in {stream}, quirks {QuirkProfile::CHIP8}, rom_size {0}, rom_hash {0},
+    rng_seed {0}, rng_stream {0}, cycles_per_tick {0}, next_cycle {0},
+    next_keypad_delta {0}, next_rng_state {0}, desync {false} {
+  std::array<char, 4> magic {};
+  std::uint8_t version {0};
+  if (!in.read(magic.data(), magic.size()) || magic != MAGIC
+      || !get(in, version)) {
+    throw std::invalid_argument("The data is not a CHIP-8 input log.");
+  }
+  if (version != VERSION) {
+    throw std::invalid_argument("Unsupported input log version.");
+  }
+  std::uint8_t profile {0};
+  if (!get(in, profile) || !get(in, rom_size) || !get(in, rom_hash)
+      || !get(in, rng_seed) || !get(in, rng_stream)
+      || !get(in, cycles_per_tick)) {
+    throw std::invalid_argument("The input log is truncated.");
+  }
+  if (profile > static_cast<std::uint8_t>(QuirkProfile::SUPER_CHIP)) {
+    throw std::invalid_argument("The input log names an unknown quirk "
+                                "profile.");
+  }
+  quirks = static_cast<QuirkProfile>(profile);
+}
+
+void InputReplayer::prepare(CHIP8& chip8, const RomImage& rom) {
+  if (rom.size() != rom_size || ::hash_rom(rom) != rom_hash) {
+    throw std::invalid_argument("The input log was recorded with another "
+                                "ROM.");
+  }
+  if (chip8.quirks != quirks) {
+    throw std::invalid_argument("The input log was recorded with the quirk "
+                                "profile " + quirk_profile_name(quirks)
+                                + ".");
+  }
+  if (chip8.cycles != 0) {
+    throw std::invalid_argument("The input log can only be replayed on a "
+                                "freshly loaded machine.");
+  }
+  chip8.set_seed(rng_seed, rng_stream);
+  chip8.set_clock(cycles_per_tick * CHIP8::TIMER_HZ);
+  next_cycle = 0;
+}
+
+bool InputReplayer::step(CHIP8& chip8) {
+  if (!next()) {
+    return false;
+  }
+  if (next_cycle > chip8.cycles) {
+    chip8.run(next_cycle - chip8.cycles);
+  }
+  apply(chip8);
+  return true;
+}
+
+bool InputReplayer::next() {
+  std::uint64_t delta {0};
+  if (!get_varint(in, delta)) {
+    return false;
+  }
+  if (!get(in, next_keypad_delta) || !get(in, next_rng_state)) {
+    throw std::invalid_argument("The input log is truncated.");
+  }
+  next_cycle += delta;
+  return true;
+}
+
+std::uint64_t InputReplayer::due() const {
+  return next_cycle;
+}
+
+void InputReplayer::apply(CHIP8& chip8) {
+  if (chip8.cycles != next_cycle || chip8.rng.state != next_rng_state) {
+    desync = true;
+  }
+  chip8.set_keypad(chip8.keypad ^ next_keypad_delta);
+}
+
+bool InputReplayer::desynced() const {
+  return desync;
+}
@@ -0,0 +1,79 @@
+#ifndef INPUT_LOG_H
+#define INPUT_LOG_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+
+#include "chip8.h"
+#include "rom.h"
+
+/*
+ * A compact, streamable log of the keypad input of one run. Together with the
+ * random number seed and clock stored in its header it is enough to replay
+ * the run exactly, without a display and as fast as the host allows. The
+ * header also identifies the ROM and quirk profile, which a replay has to
+ * match. Both the recorded run and the replay start from a freshly loaded
+ * machine, as the log holds nothing of the state a machine reached before.
+ *
+ * Layout, all fixed-size integers little-endian:
+ *   "C8IL" magic, 1 byte format version
+ *   u8 quirk profile, u32 ROM size and u64 FNV-1a hash of the ROM
+ *   u64 rng seed, u64 rng stream and u32 cycles_per_tick of the run
+ *   per keypad change:
+ *     LEB128 number of cycles since the previous record
+ *     u16 keypad state XOR the previous keypad state
+ *     u64 rng state when the change is applied, used to detect desyncs
+ */
+class InputRecorder {
+public:
+  // Writes the header for a run of rom on chip8. Throws
+  // std::invalid_argument if chip8 already ran, as a replay could not
+  // reproduce the state it reached.
+  InputRecorder(std::ostream& stream, const CHIP8& chip8, const RomImage& rom);
+  // Appends a record if the keypad of chip8 changed since the last call.
+  void record(const CHIP8& chip8);
+
+private:
+  std::ostream& out;
+  std::uint64_t last_cycle;
+  std::uint16_t last_keypad;
+};
+
+class InputReplayer {
+public:
+  // Reads the header. Throws std::invalid_argument if in is not an input log.
+  explicit InputReplayer(std::istream& stream);
+  // Applies the seed and clock of the recorded run to chip8, freshly loaded
+  // with rom, so that a later reset starts over with the same numbers.
+  // Throws std::invalid_argument if chip8 already ran or the run was
+  // recorded with another ROM or quirk profile, as the replay could not
+  // follow it.
+  void prepare(CHIP8& chip8, const RomImage& rom);
+  // Runs chip8 up to the next keypad change and applies it. Returns false once
+  // the log is exhausted. Sets desynced if the machine did not reach the
+  // recorded state.
+  bool step(CHIP8& chip8);
+  // The same split in two, for callers that run chip8 themselves: next reads
+  // the next keypad change, or returns false once the log is exhausted. Once
+  // chip8 has been run up to due(), apply makes the change.
+  bool next();
+  std::uint64_t due() const;
+  void apply(CHIP8& chip8);
+  bool desynced() const;
+
+private:
+  std::istream& in;
+  QuirkProfile quirks;
+  std::uint32_t rom_size;
+  std::uint64_t rom_hash;
+  std::uint64_t rng_seed;
+  std::uint64_t rng_stream;
+  std::uint32_t cycles_per_tick;
+  std::uint64_t next_cycle;
+  std::uint16_t next_keypad_delta;
+  std::uint64_t next_rng_state;
+  bool desync;
+};
+
+#endif // INPUT_LOG_H
@@ -0,0 +1,25 @@
+#ifndef INSTRUCTION_H
+#define INSTRUCTION_H
+
+#include <cstdint>
+
+class CHIP8;
+
+/*
+ * A decoded CHIP-8 instruction. The operand fields are extracted once when the
+ * opcode is decoded so the handlers never have to mask and shift on the hot
+ * path. Fields an operation does not use are still filled in but ignored.
+ */
+struct Instruction {
+  using Handler = void (*)(CHIP8* chip8, const Instruction& ins);
+
+  Handler handler; // nullptr marks an empty instruction cache slot
+  std::uint16_t opcode;
+  std::uint16_t NNN; // lowest 12 bits
+  std::uint8_t X; // lower 4 bits of the high byte
+  std::uint8_t Y; // upper 4 bits of the low byte
+  std::uint8_t N; // lowest 4 bits
+  std::uint8_t NN; // lowest 8 bits
+};
+
+#endif // INSTRUCTION_H
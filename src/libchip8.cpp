@@ -0,0 +1,195 @@
+#include "libchip8.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include "analyzer.h"
+#include "chip8.h"
+#include "quirks.h"
+#include "rom.h"
+#include "snapshot.h"
+
+struct chip8_machine {
+  explicit chip8_machine(const RomImage& rom)
+    : chip8 {rom}, analysis {chip8} {}
+
+  CHIP8 chip8;
+  // Analysis of the loaded ROM, used to warm the caches up again whenever
+  // they are dropped outside of chip8_run_cycles.
+  Analysis analysis;
+};
+
+struct chip8_snapshot {
+  Snapshot snapshot;
+};
+
+namespace {
+thread_local std::string last_error {};
+
+void fail(const char* message) {
+  try {
+    last_error = message;
+  } catch (...) {
+    last_error.clear();
+  }
+}
+
+// Predecodes and translates the reachable code, returns -1 on failure.
+int warm_up(chip8_machine* machine) {
+  try {
+    machine->analysis.warm_up(machine->chip8);
+  } catch (const std::exception& e) {
+    fail(e.what());
+    return -1;
+  }
+  return 0;
+}
+} // namespace
+
+const char* chip8_last_error(void) {
+  return last_error.c_str();
+}
+
+chip8_machine* chip8_create(const uint8_t* rom, size_t size) {
+  try {
+    chip8_machine* machine {new chip8_machine {RomImage {rom, size}}};
+    // Whatever fails to warm up is decoded on first execution instead.
+    ::warm_up(machine);
+    return machine;
+  } catch (const std::exception& e) {
+    fail(e.what());
+  } catch (...) {
+    fail("Unknown error.");
+  }
+  return nullptr;
+}
+
+void chip8_destroy(chip8_machine* machine) {
+  delete machine;
+}
+
+int chip8_reset(chip8_machine* machine, const uint8_t* rom, size_t size) {
+  try {
+    machine->chip8.reset(RomImage {rom, size});
+    machine->analysis = Analysis {machine->chip8};
+  } catch (const std::exception& e) {
+    fail(e.what());
+    return -1;
+  }
+  return ::warm_up(machine);
+}
+
+int chip8_set_quirks(chip8_machine* machine, int quirks) {
+  switch (quirks) {
+    case CHIP8_QUIRKS_CHIP8:
+      machine->chip8.set_quirks(QuirkProfile::CHIP8);
+      break;
+    case CHIP8_QUIRKS_CHIP48:
+      machine->chip8.set_quirks(QuirkProfile::CHIP48);
+      break;
+    case CHIP8_QUIRKS_SUPER_CHIP:
+      machine->chip8.set_quirks(QuirkProfile::SUPER_CHIP);
+      break;
+    default:
+      fail("Unknown quirk profile.");
+      return -1;
+  }
+  return ::warm_up(machine);
+}
+
+int chip8_set_blocks(chip8_machine* machine, int enabled) {
+  machine->chip8.mode = enabled ? ExecutionMode::BLOCKS
+                                : ExecutionMode::INTERPRETER;
+  return ::warm_up(machine);
+}
+
+void chip8_set_clock(chip8_machine* machine, uint32_t hz) {
+  machine->chip8.set_clock(hz);
+}
+
+void chip8_set_seed(chip8_machine* machine, uint64_t seed, uint64_t stream) {
+  machine->chip8.set_seed(seed, stream);
+}
+
+uint64_t chip8_run_cycles(chip8_machine* machine, uint64_t cycles) {
+  try {
+    machine->chip8.run(cycles);
+  } catch (const std::exception& e) {
+    // Only translating a block allocates, and only for code that was not
+    // warmed up.
+    fail(e.what());
+  }
+  return machine->chip8.cycles;
+}
+
+int chip8_halted(const chip8_machine* machine) {
+  return machine->chip8.halted();
+}
+
+void chip8_set_keypad(chip8_machine* machine, uint16_t keys) {
+  machine->chip8.set_keypad(keys);
+}
+
+void chip8_set_key(chip8_machine* machine, uint8_t key, int pressed) {
+  machine->chip8.set_key(key, pressed != 0);
+}
+
+const uint64_t* chip8_framebuffer(const chip8_machine* machine) {
+  return machine->chip8.display.data();
+}
+
+uint32_t chip8_take_changed_rows(chip8_machine* machine) {
+  return machine->chip8.take_changed_rows();
+}
+
+int chip8_sound_active(const chip8_machine* machine) {
+  return machine->chip8.sound_timer > 0;
+}
+
+chip8_snapshot* chip8_snapshot_take(chip8_machine* machine) {
+  try {
+    return new chip8_snapshot {machine->chip8.snapshot()};
+  } catch (const std::exception& e) {
+    fail(e.what());
+  }
+  return nullptr;
+}
+
+void chip8_snapshot_free(chip8_snapshot* snapshot) {
+  delete snapshot;
+}
+
+int chip8_snapshot_restore(chip8_machine* machine,
+                           const chip8_snapshot* snapshot) {
+  machine->chip8.restore(snapshot->snapshot);
+  // Restoring drops whatever was cached for the pages it copied.
+  return ::warm_up(machine);
+}
+
+size_t chip8_snapshot_serialize(const chip8_snapshot* snapshot, uint8_t* out,
+                                size_t capacity) {
+  try {
+    const std::vector<std::uint8_t> data {snapshot->snapshot.serialize()};
+    if (out && data.size() <= capacity) {
+      std::memcpy(out, data.data(), data.size());
+    }
+    return data.size();
+  } catch (const std::exception& e) {
+    fail(e.what());
+  }
+  return 0;
+}
+
+chip8_snapshot* chip8_snapshot_deserialize(const uint8_t* data, size_t size) {
+  try {
+    return new chip8_snapshot {
+      Snapshot::deserialize(std::vector<std::uint8_t>(data, data + size))};
+  } catch (const std::exception& e) {
+    fail(e.what());
+  }
+  return nullptr;
+}
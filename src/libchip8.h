@@ -0,0 +1,115 @@
+#ifndef LIBCHIP8_H
+#define LIBCHIP8_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * C interface of libchip8, for hosts that drive the emulator core themselves
+ * (ctypes, other languages, job runners) instead of going through one of the
+ * executables.
+ *
+ * No C++ exception ever crosses this interface. Functions that can fail
+ * return NULL or a negative value, chip8_last_error then describes the most
+ * recent failure on the calling thread.
+ *
+ * chip8_run_cycles, chip8_set_keypad, chip8_set_key, chip8_framebuffer,
+ * chip8_take_changed_rows and chip8_halted never allocate. chip8_create
+ * predecodes the reachable code up front; only code the program writes at
+ * runtime is decoded, and in block mode translated, while it runs.
+ *
+ * A machine must not be used by two threads at the same time, different
+ * machines are independent.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct chip8_machine chip8_machine;
+typedef struct chip8_snapshot chip8_snapshot;
+
+/* Values for chip8_set_quirks, see quirks.h. */
+enum {
+  CHIP8_QUIRKS_CHIP8 = 0,
+  CHIP8_QUIRKS_CHIP48 = 1,
+  CHIP8_QUIRKS_SUPER_CHIP = 2
+};
+
+/* Describes the last failure on the calling thread, never NULL. */
+const char* chip8_last_error(void);
+
+/*
+ * Creates a machine with the ROM loaded at 0x200, copying rom. Returns NULL
+ * if the ROM does not fit into memory.
+ */
+chip8_machine* chip8_create(const uint8_t* rom, size_t size);
+void chip8_destroy(chip8_machine* machine);
+/*
+ * Loads another ROM into the machine and returns it to its initial state,
+ * keeping the clock, mode, quirks and seed. Reuses the machine's memory, so
+ * recycling machines is cheaper than destroying and creating them. Returns -1
+ * and leaves the machine untouched if the ROM does not fit into memory.
+ */
+int chip8_reset(chip8_machine* machine, const uint8_t* rom, size_t size);
+
+/*
+ * Selects the interpreter the ROM was written for. Returns -1 if quirks is
+ * unknown or the code could not be predecoded again.
+ */
+int chip8_set_quirks(chip8_machine* machine, int quirks);
+/*
+ * Executes translated basic blocks instead of single instructions. Returns -1
+ * if the code could not be translated.
+ */
+int chip8_set_blocks(chip8_machine* machine, int enabled);
+/* Instructions per second, determines how often the timers count down. */
+void chip8_set_clock(chip8_machine* machine, uint32_t hz);
+/* Restarts the random number generator of CXNN, see CHIP8::set_seed. */
+void chip8_set_seed(chip8_machine* machine, uint64_t seed, uint64_t stream);
+
+/*
+ * Executes cycles instructions and returns the total executed so far. Stops
+ * early only if translating a block fails, see chip8_last_error.
+ */
+uint64_t chip8_run_cycles(chip8_machine* machine, uint64_t cycles);
+/* Non-zero if the program cannot make progress without input. */
+int chip8_halted(const chip8_machine* machine);
+
+/* Bit N of keys is set while key N is held down. */
+void chip8_set_keypad(chip8_machine* machine, uint16_t keys);
+void chip8_set_key(chip8_machine* machine, uint8_t key, int pressed);
+
+/*
+ * The 64x32 display as 32 rows, column 0 in the highest bit of each row. The
+ * pointer stays valid for the lifetime of the machine.
+ */
+const uint64_t* chip8_framebuffer(const chip8_machine* machine);
+/* Rows changed since the previous call, bit N for row N. */
+uint32_t chip8_take_changed_rows(chip8_machine* machine);
+/* Non-zero while the sound timer is running. */
+int chip8_sound_active(const chip8_machine* machine);
+
+/*
+ * Captures the state of the machine. Consecutive snapshots of one machine
+ * share the memory pages the program did not write in between. Returns NULL
+ * if out of memory.
+ */
+chip8_snapshot* chip8_snapshot_take(chip8_machine* machine);
+void chip8_snapshot_free(chip8_snapshot* snapshot);
+int chip8_snapshot_restore(chip8_machine* machine,
+                           const chip8_snapshot* snapshot);
+/*
+ * Writes the snapshot in the format of Snapshot::serialize to out if it
+ * holds at least capacity bytes. Returns the size of the serialized
+ * snapshot either way, so a first call with capacity 0 asks for the size.
+ */
+size_t chip8_snapshot_serialize(const chip8_snapshot* snapshot, uint8_t* out,
+                                size_t capacity);
+/* Returns NULL if data is not a serialized snapshot. */
+chip8_snapshot* chip8_snapshot_deserialize(const uint8_t* data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBCHIP8_H */
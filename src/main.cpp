@@ -1,70 +1,306 @@
+#include <array>
 #include <iostream>
 #include <cstdint>
 #include <string>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
 
 #include <SDL2/SDL.h>
+#include "analyzer.h"
+#include "arena.h"
 #include "chip8.h"
-#include "cpu.h"
+#include "input_log.h"
+#include "quirks.h"
+#include "spsc_ring.h"
+#include "translator.h"
 
 namespace {
-void update_screen(CHIP8* chip8, SDL_Renderer* renderer) {
-  SDL_RenderClear(renderer);
-  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-  SDL_RenderPresent(renderer);
-  SDL_RenderClear(renderer);
-  SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-  for (int row_idx {0}; row_idx < 32; row_idx += 2) {
-    for (int col_idx {0}; col_idx < 64; col_idx += 2) {
-      if (chip8->display[row_idx][col_idx]) {
-        for (std::uint8_t p_row {0}; p_row < 25; ++p_row) {
-          for (std::uint8_t p_col {0}; p_col < 25; ++p_col) {
-            SDL_RenderDrawPoint(renderer,
-                                col_idx * 25 + p_col,
-                                row_idx * 25 + p_row);
-          } 
-        }
+// Duration of one frame: input is polled and the screen redrawn every frame.
+constexpr std::chrono::microseconds FRAME_DURATION {1000000 / CHIP8::TIMER_HZ};
+// Instructions executed by both machines when verifying the block translator.
+constexpr std::size_t VERIFY_CYCLES {1000000};
+
+// Maps the left side of a QWERTY keyboard onto the hexadecimal keypad.
+// Returns -1 for keys that are not mapped.
+int keypad_key(SDL_Keycode keycode) {
+  switch (keycode) {
+    case SDLK_1: return 0x0;
+    case SDLK_2: return 0x1;
+    case SDLK_3: return 0x2;
+    case SDLK_4: return 0x3;
+    case SDLK_q: return 0x4;
+    case SDLK_w: return 0x5;
+    case SDLK_e: return 0x6;
+    case SDLK_r: return 0x7;
+    case SDLK_a: return 0x8;
+    case SDLK_s: return 0x9;
+    case SDLK_d: return 0xA;
+    case SDLK_f: return 0xB;
+    case SDLK_z: return 0xC;
+    case SDLK_x: return 0xD;
+    case SDLK_c: return 0xE;
+    case SDLK_v: return 0xF;
+    default: return -1;
+  }
+}
+
+constexpr Uint32 PIXEL_ON {0xFFFFFFFF};
+constexpr Uint32 PIXEL_OFF {0xFF000000};
+
+/*
+ * Keeps the display in a 64x32 streaming texture which the renderer scales up
+ * to the window. Only the given rows are sent to the texture, and every
+ * update presents exactly once.
+ */
+struct Screen {
+  SDL_Texture* texture;
+  std::array<Uint32, 64 * 32> pixels;
+};
+
+void update_screen(CHIP8* chip8, SDL_Renderer* renderer, Screen& screen,
+                   std::uint32_t rows) {
+  std::size_t row_idx {0};
+  while (row_idx < 32) {
+    if (!((rows >> row_idx) & 1)) {
+      ++row_idx;
+      continue;
+    }
+    // Upload each run of consecutive changed rows with a single call.
+    const std::size_t first_row {row_idx};
+    for (; row_idx < 32 && ((rows >> row_idx) & 1); ++row_idx) {
+      const std::uint64_t row {chip8->display[row_idx]};
+      for (std::size_t col_idx {0}; col_idx < 64; ++col_idx) {
+        screen.pixels[row_idx * 64 + col_idx] =
+          (row >> (63 - col_idx)) & 1 ? PIXEL_ON : PIXEL_OFF;
       }
     }
+    const SDL_Rect rect {0, static_cast<int>(first_row), 64,
+                         static_cast<int>(row_idx - first_row)};
+    SDL_UpdateTexture(screen.texture, &rect, &screen.pixels[first_row * 64],
+                      64 * sizeof(Uint32));
   }
+  SDL_RenderCopy(renderer, screen.texture, nullptr, nullptr);
   SDL_RenderPresent(renderer);
 }
+
+// The beep is a square wave, played while the sound timer is above zero.
+constexpr int AUDIO_RATE {44100};
+constexpr int BEEP_PERIOD {AUDIO_RATE / 440}; // in samples
+constexpr int BEEP_AMPLITUDE {3000};
+constexpr int SAMPLES_PER_FRAME {AUDIO_RATE / CHIP8::TIMER_HZ};
+
+/*
+ * Carries the sound timer from the emulation loop to the audio callback,
+ * which runs on a thread of its own. The loop publishes the timer once per
+ * frame and the callback plays each published value for one frame's worth
+ * of samples. The ring is lock-free and both sides only ever try: a frame
+ * is dropped when the ring is full, and the callback falls silent when it
+ * runs dry instead of holding the last tone.
+ */
+struct Beeper {
+  SpscRing<std::uint8_t, 8> frames;
+  // Only touched by the audio callback once the device runs.
+  std::uint8_t sound_timer; // value of the frame being played
+  int samples_left; // samples left to play of that frame
+  int phase; // position within the period of the square wave
+};
+
+void play_beep(void* userdata, Uint8* stream, int length) {
+  Beeper& beeper {*static_cast<Beeper*>(userdata)};
+  Sint16* samples {reinterpret_cast<Sint16*>(stream)};
+  const int sample_count {length / static_cast<int>(sizeof(Sint16))};
+  for (int sample_idx {0}; sample_idx < sample_count; ++sample_idx) {
+    if (!beeper.samples_left) {
+      if (beeper.frames.try_pop(beeper.sound_timer)) {
+        beeper.samples_left = SAMPLES_PER_FRAME;
+      } else {
+        beeper.sound_timer = 0;
+      }
+    }
+    if (beeper.samples_left) {
+      --beeper.samples_left;
+    }
+    const int level {beeper.phase < BEEP_PERIOD / 2 ? BEEP_AMPLITUDE
+                                                    : -BEEP_AMPLITUDE};
+    samples[sample_idx] = static_cast<Sint16>(beeper.sound_timer ? level : 0);
+    beeper.phase = (beeper.phase + 1) % BEEP_PERIOD;
+  }
+}
+
+// Opens the default output device, returns 0 if there is none.
+SDL_AudioDeviceID open_audio(Beeper& beeper) {
+  if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+    return 0;
+  }
+  SDL_AudioSpec spec {};
+  spec.freq = AUDIO_RATE;
+  spec.format = AUDIO_S16SYS;
+  spec.channels = 1;
+  spec.samples = 512;
+  spec.callback = &::play_beep;
+  spec.userdata = &beeper;
+  const SDL_AudioDeviceID device {
+    SDL_OpenAudioDevice(nullptr, 0, &spec, nullptr, 0)};
+  if (device) {
+    SDL_PauseAudioDevice(device, 0);
+  }
+  return device;
+}
 } // namespace
 
 int main(int argc, char* argv[]) {
   if (argc < 2) {
-    std::cout << "Missing filename. (e.g. \"./chip8 <$ROM_PATH>\")\n";
+    std::cout << "Missing filename. (e.g. \"./chip8 <$ROM_PATH> "
+              << "[--blocks] [--verify] [--clock HZ] [--fast] "
+              << "[--record INPUT_LOG] [--quirks chip8|chip48|schip] "
+              << "[--seed N]\")\n";
     return 1;
   }
   const std::string file_location {argv[1]};
-  CHIP8* chip8 {new CHIP8{file_location}};
+  ExecutionMode mode {ExecutionMode::INTERPRETER};
+  std::uint32_t clock_hz {CHIP8::DEFAULT_CLOCK_HZ};
+  bool fast_forward {false};
+  std::string record_path {};
+  bool verify {false};
+  QuirkProfile quirks {QuirkProfile::CHIP8};
+  std::uint64_t seed {static_cast<std::uint64_t>(std::time(nullptr))};
+  for (int arg_idx {2}; arg_idx < argc; ++arg_idx) {
+    const std::string option {argv[arg_idx]};
+    if (option == "--verify") {
+      // Compare the block translator against the interpreter and exit.
+      verify = true;
+    } else if (option == "--blocks") {
+      mode = ExecutionMode::BLOCKS;
+    } else if (option == "--clock" && arg_idx + 1 < argc) {
+      clock_hz = std::strtoul(argv[++arg_idx], nullptr, 10);
+    } else if (option == "--fast") {
+      // Run as fast as the host allows instead of at clock_hz.
+      fast_forward = true;
+    } else if (option == "--record" && arg_idx + 1 < argc) {
+      // Log every key press so the run can be replayed by chip8-headless.
+      record_path = argv[++arg_idx];
+    } else if (option == "--quirks" && arg_idx + 1 < argc) {
+      // Follow the interpreter the ROM was written for.
+      try {
+        quirks = parse_quirk_profile(argv[++arg_idx]);
+      } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+      }
+    } else if (option == "--seed" && arg_idx + 1 < argc) {
+      // Draw the same random numbers as an earlier run.
+      seed = std::strtoull(argv[++arg_idx], nullptr, 10);
+    } else {
+      std::cerr << "Unknown option: " << option << '\n';
+      return 1;
+    }
+  }
+  if (verify) {
+    return verify_translation(file_location, quirks, VERIFY_CYCLES, std::cerr)
+           ? 0 : 1;
+  }
+  // A single machine, but aligned so its registers share a cache line.
+  MachineArena arena {1};
+  const RomImage rom {file_location};
+  CHIP8* chip8 {arena.acquire(rom)};
+  chip8->mode = mode;
+  chip8->set_clock(clock_hz);
+  chip8->set_quirks(quirks);
+  chip8->set_seed(seed, 0);
+  const Analysis analysis {*chip8};
+  for (const std::string& problem : analysis.problems) {
+    std::cerr << "Warning: " << problem << '\n';
+  }
+  analysis.warm_up(*chip8);
+  std::ofstream record_file {};
+  std::unique_ptr<InputRecorder> recorder {};
+  if (!record_path.empty()) {
+    record_file.open(record_path, std::ios::binary);
+    recorder.reset(new InputRecorder {record_file, *chip8, rom});
+  }
+  const std::size_t cycles_per_frame {clock_hz > CHIP8::TIMER_HZ
+                                      ? clock_hz / CHIP8::TIMER_HZ
+                                      : 1};
+  if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+    std::cerr << SDL_GetError() << '\n';
+    return 1;
+  }
+  Beeper beeper {{}, 0, 0, 0};
+  const SDL_AudioDeviceID audio {::open_audio(beeper)};
+  if (!audio) {
+    std::cerr << "Warning: no sound, " << SDL_GetError() << '\n';
+  }
   // Window resolution = 1600x800 thus each CHIP8 pixel = a 25x25 quadrant.
   SDL_Window* window {SDL_CreateWindow("CHIP-8 Emulator",
                                        SDL_WINDOWPOS_CENTERED,
                                        SDL_WINDOWPOS_CENTERED,
                                        1600, 800, 0)};
   SDL_Renderer* renderer {SDL_CreateRenderer(window, -1, 0)};
-  ::update_screen(chip8, renderer);
-  /**
-   *  TODO: for the main loop, make sure to calculate the number of CPU cycles
-   * it should take before you decrement the sound and delay timers again.
-   * e.g. if our CPU clock speed is 120 Hz, we should decrement the registers
-   * every 2 cycles rather than every cycle @ 60 Hz
-   */
+  Screen screen {SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                   SDL_TEXTUREACCESS_STREAMING, 64, 32),
+                 {}};
+  ::update_screen(chip8, renderer, screen, 0xFFFFFFFF);
+  const auto start {std::chrono::steady_clock::now()};
+  auto next_frame {start};
   // Handles user input.
   SDL_Event event;
   while (true) {
-    if (chip8->needs_redrawing()) {
-      ::update_screen(chip8, renderer);
-    }
     while (SDL_PollEvent(&event)) {
+      // Key presses only update the keypad state, the CPU reads it on its
+      // own time without ever blocking.
+      const int key {event.type == SDL_KEYDOWN || event.type == SDL_KEYUP
+                     ? keypad_key(event.key.keysym.sym)
+                     : -1};
+      if (key >= 0) {
+        chip8->set_key(static_cast<std::uint8_t>(key),
+                       event.type == SDL_KEYDOWN);
+      }
       if (event.type == SDL_QUIT) {
+        const std::chrono::duration<double> elapsed {
+          std::chrono::steady_clock::now() - start};
+        std::cout << chip8->cycles << " instructions in " << elapsed.count()
+                  << " s (" << chip8->cycles / elapsed.count()
+                  << " instructions/s)\n";
+        if (chip8->unknown_operations) {
+          std::cerr << "Warning: " << chip8->unknown_operations
+                    << " unknown operations executed, the last one "
+                    << std::hex << std::uppercase
+                    << chip8->last_unknown_opcode << ".\n";
+        }
+        if (audio) {
+          SDL_CloseAudioDevice(audio);
+        }
+        SDL_DestroyTexture(screen.texture);
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
         SDL_Quit();
-        delete chip8;
         return 0;
       }
-      chip8->clock_cycle();
+    }
+    if (recorder) {
+      recorder->record(*chip8);
+    }
+    // The timers are driven by the instruction count, so one frame worth of
+    // instructions also advances them by exactly one tick.
+    chip8->run(cycles_per_frame);
+    // Never waits on the audio callback: if it has fallen behind and the
+    // ring is full, the sound of this frame is dropped.
+    if (audio) {
+      beeper.frames.try_push(chip8->sound_timer);
+    }
+    // Frames that drew nothing visible are neither uploaded nor presented.
+    const std::uint32_t changed_rows {chip8->take_changed_rows()};
+    if (changed_rows) {
+      ::update_screen(chip8, renderer, screen, changed_rows);
+    }
+    next_frame += FRAME_DURATION;
+    if (!fast_forward) {
+      std::this_thread::sleep_until(next_frame);
     }
   }
 }
@@ -0,0 +1,163 @@
+#include "pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "chip8.h"
+
+EmulatorPool::EmulatorPool(std::size_t threads, std::uint64_t slice)
+  : thread_count {threads ? threads
+                          : std::max(1u, std::thread::hardware_concurrency())},
+    slice_cycles {slice}, tasks {}, workers {}, unfinished {0}, queued {0},
+    idle_lock {}, work_available {}, elapsed_seconds {0} {
+  if (slice == 0) {
+    throw std::invalid_argument("The time slice must be at least one cycle.");
+  }
+}
+
+std::size_t EmulatorPool::add(std::unique_ptr<CHIP8> chip8,
+                              std::uint64_t max_cycles) {
+  CHIP8* instance_ptr {chip8.get()};
+  tasks.push_back(
+    Task {std::move(chip8), instance_ptr, max_cycles, Stats {0, 0, false}});
+  return tasks.size() - 1;
+}
+
+std::size_t EmulatorPool::add(CHIP8& chip8, std::uint64_t max_cycles) {
+  tasks.push_back(Task {{}, &chip8, max_cycles, Stats {0, 0, false}});
+  return tasks.size() - 1;
+}
+
+void EmulatorPool::run() {
+  workers.clear();
+  for (std::size_t idx {0}; idx < thread_count; ++idx) {
+    workers.emplace_back(new Worker {});
+  }
+  // Deal the instances out round-robin, the workers balance the rest.
+  for (std::size_t task_idx {0}; task_idx < tasks.size(); ++task_idx) {
+    workers[task_idx % thread_count]->queue.push_back(task_idx);
+  }
+  unfinished = tasks.size();
+  queued = tasks.size();
+  const auto start {std::chrono::steady_clock::now()};
+  std::vector<std::thread> threads {};
+  for (std::size_t idx {1}; idx < thread_count; ++idx) {
+    threads.emplace_back(&EmulatorPool::work, this, idx);
+  }
+  work(0);
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  const std::chrono::duration<double> elapsed {
+    std::chrono::steady_clock::now() - start};
+  elapsed_seconds = elapsed.count();
+}
+
+void EmulatorPool::work(std::size_t worker_idx) {
+  Worker& own {*workers[worker_idx]};
+  std::size_t task_idx {0};
+  while (unfinished > 0) {
+    if (!next_task(worker_idx, task_idx)) {
+      // The remaining instances are being run by other workers right now.
+      wait_for_work();
+      continue;
+    }
+    // The counts that sleeping workers wait on only change under idle_lock,
+    // so that none of them misses the notification.
+    if (run_slice(tasks[task_idx])) {
+      std::unique_lock<std::mutex> idle_guard {idle_lock};
+      if (--unfinished == 0) {
+        idle_guard.unlock();
+        work_available.notify_all();
+      }
+    } else {
+      {
+        std::lock_guard<std::mutex> idle_guard {idle_lock};
+        std::lock_guard<std::mutex> guard {own.lock};
+        own.queue.push_back(task_idx);
+        ++queued;
+      }
+      work_available.notify_one();
+    }
+  }
+}
+
+void EmulatorPool::wait_for_work() {
+  std::unique_lock<std::mutex> guard {idle_lock};
+  work_available.wait(guard, [this] { return queued > 0 || unfinished == 0; });
+}
+
+bool EmulatorPool::next_task(std::size_t worker_idx, std::size_t& task_idx) {
+  {
+    Worker& own {*workers[worker_idx]};
+    std::lock_guard<std::mutex> guard {own.lock};
+    if (!own.queue.empty()) {
+      task_idx = own.queue.back();
+      own.queue.pop_back();
+      --queued;
+      return true;
+    }
+  }
+  for (std::size_t offset {1}; offset < workers.size(); ++offset) {
+    Worker& victim {*workers[(worker_idx + offset) % workers.size()]};
+    std::lock_guard<std::mutex> guard {victim.lock};
+    if (!victim.queue.empty()) {
+      task_idx = victim.queue.front();
+      victim.queue.pop_front();
+      --queued;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool EmulatorPool::run_slice(Task& task) {
+  CHIP8& chip8 {*task.chip8};
+  const auto start {std::chrono::steady_clock::now()};
+  const std::uint64_t remaining {task.max_cycles - task.stats.cycles};
+  task.stats.cycles += chip8.run(std::min(remaining, slice_cycles));
+  const std::chrono::duration<double> elapsed {
+    std::chrono::steady_clock::now() - start};
+  task.stats.seconds += elapsed.count();
+  task.stats.halted = chip8.halted();
+  return task.stats.halted || task.stats.cycles >= task.max_cycles;
+}
+
+std::size_t EmulatorPool::size() const {
+  return tasks.size();
+}
+
+CHIP8& EmulatorPool::instance(std::size_t idx) {
+  return *tasks.at(idx).chip8;
+}
+
+const EmulatorPool::Stats& EmulatorPool::stats(std::size_t idx) const {
+  return tasks.at(idx).stats;
+}
+
+void EmulatorPool::report(std::ostream& out) const {
+  std::uint64_t total_cycles {0};
+  for (std::size_t idx {0}; idx < tasks.size(); ++idx) {
+    const Stats& task_stats {tasks[idx].stats};
+    total_cycles += task_stats.cycles;
+    out << "instance " << idx << ": " << task_stats.cycles << " instructions, "
+        << (task_stats.seconds > 0 ? task_stats.cycles / task_stats.seconds
+                                   : 0)
+        << " instructions/s" << (task_stats.halted ? " (halted)" : "") << '\n';
+  }
+  out << "total: " << total_cycles << " instructions in " << elapsed_seconds
+      << " s on " << thread_count << " threads ("
+      << (elapsed_seconds > 0 ? total_cycles / elapsed_seconds : 0)
+      << " instructions/s)\n";
+}
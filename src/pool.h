@@ -0,0 +1,82 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#include "chip8.h"
+
+/*
+ * Runs many independent CHIP8 instances across a set of worker threads.
+ * Instances are handed out in time slices of a fixed number of cycles. Each
+ * worker owns a queue of instances and requeues an instance there after its
+ * slice; a worker that runs out of work steals from the front of another
+ * worker's queue, or sleeps until an instance is requeued.
+ */
+class EmulatorPool {
+public:
+  struct Stats {
+    std::uint64_t cycles; // instructions executed by the instance
+    double seconds; // time spent executing the instance's slices
+    bool halted; // stopped before reaching its cycle limit
+  };
+
+public:
+  // A thread count of 0 uses one thread per hardware thread.
+  EmulatorPool(std::size_t threads, std::uint64_t slice);
+  // Adds an instance that is run until it halts or executed max_cycles
+  // instructions, and returns its index.
+  std::size_t add(std::unique_ptr<CHIP8> chip8, std::uint64_t max_cycles);
+  // Same as above for an instance owned elsewhere, e.g. by a MachineArena.
+  // It must outlive the pool.
+  std::size_t add(CHIP8& chip8, std::uint64_t max_cycles);
+  // Runs every instance to completion, blocking until all are done.
+  void run();
+  std::size_t size() const;
+  CHIP8& instance(std::size_t idx);
+  const Stats& stats(std::size_t idx) const;
+  // Writes per-instance and aggregate throughput of the last run.
+  void report(std::ostream& out) const;
+
+private:
+  struct Task {
+    std::unique_ptr<CHIP8> owned; // empty if the caller owns the instance
+    CHIP8* chip8;
+    std::uint64_t max_cycles;
+    Stats stats;
+  };
+
+  struct Worker {
+    std::mutex lock {};
+    std::deque<std::size_t> queue {};
+  };
+
+private:
+  void work(std::size_t worker_idx);
+  bool next_task(std::size_t worker_idx, std::size_t& task_idx);
+  // Blocks until an instance is queued or every instance has finished.
+  void wait_for_work();
+  // Runs one slice of the task and returns true once it is finished.
+  bool run_slice(Task& task);
+
+private:
+  std::size_t thread_count;
+  std::uint64_t slice_cycles;
+  std::vector<Task> tasks;
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<std::size_t> unfinished;
+  std::atomic<std::size_t> queued; // instances waiting in any queue
+  std::mutex idle_lock;
+  std::condition_variable work_available;
+  double elapsed_seconds;
+};
+
+#endif // POOL_H
@@ -0,0 +1,221 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "chip8.h"
+#include "cpu.h"
+
+namespace {
+constexpr const char* HEX_DIGITS {"0123456789ABCDEF"};
+
+// Opcode patterns per leading nibble, '_' marks the digits taken from the
+// opcode itself.
+constexpr std::array<const char*, 16> CLASS_PATTERNS {{
+  "0NNN", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "6XNN", "7XNN",
+  "8XY_", "9XY0", "ANNN", "BNNN", "CXNN", "DXYN", "EX__", "FX__"
+}};
+
+// Masks out the operand fields of the opcode, so that every opcode of the
+// same operation maps to the same class.
+std::uint16_t opcode_class(std::uint16_t opcode) {
+  switch (opcode & 0xF000) {
+    case 0x0000:
+      return opcode == 0x00E0 || opcode == 0x00EE ? opcode : 0x0000;
+    case 0x8000: return opcode & 0xF00F;
+    case 0xE000:
+    case 0xF000: return opcode & 0xF0FF;
+    default: return opcode & 0xF000;
+  }
+}
+
+std::string class_name(std::uint16_t opcode_class) {
+  if (opcode_class == 0x00E0) {
+    return "00E0";
+  }
+  if (opcode_class == 0x00EE) {
+    return "00EE";
+  }
+  std::string name {CLASS_PATTERNS[opcode_class >> 12]};
+  for (std::size_t digit {1}; digit < 4; ++digit) {
+    if (name[digit] == '_') {
+      const std::size_t nibble {(opcode_class >> (4 * (3 - digit))) & 0xFu};
+      name[digit] = HEX_DIGITS[nibble];
+    }
+  }
+  return name;
+}
+
+std::string frame_name(std::uint16_t address) {
+  if (address == 0x200) {
+    return "main";
+  }
+  std::string name {"sub_000"};
+  for (std::size_t digit {0}; digit < 3; ++digit) {
+    name[4 + digit] = HEX_DIGITS[(address >> (4 * (2 - digit))) & 0xF];
+  }
+  return name;
+}
+
+double percent(std::uint64_t part, std::uint64_t whole) {
+  return whole ? 100.0 * part / whole : 0.0;
+}
+} // namespace
+
+constexpr bool NullProfiler::SKIPS_IDLE;
+constexpr bool NullProfiler::RUNS_BLOCKS;
+constexpr bool Profiler::SKIPS_IDLE;
+constexpr bool Profiler::RUNS_BLOCKS;
+constexpr std::size_t Profiler::MAX_DEPTH;
+
+Profiler::Profiler()
+  : classes(0x10000, ClassStats {0, std::chrono::nanoseconds {0}}),
+    addresses {}, opcodes {}, instructions {0}, draws {0}, clears {0},
+    ticks_seen {0}, ticks_drawn {0},
+    last_tick {std::numeric_limits<std::uint64_t>::max()},
+    last_drawn_tick {std::numeric_limits<std::uint64_t>::max()},
+    frames {Frame {-1, 0x200, 0, {}}}, current_frame {0}, depth {0},
+    started {} {}
+
+/**
+ * Called right before the handler of the instruction at address runs.
+ */
+void Profiler::begin(const CHIP8&, std::uint16_t address,
+                     const Instruction& ins) {
+  ++addresses[address & 0xFFF];
+  opcodes[address & 0xFFF] = ins.opcode;
+  ++frames[current_frame].samples;
+  started = std::chrono::steady_clock::now();
+}
+
+/**
+ * Called right after the handler ran, before the timers are advanced.
+ */
+void Profiler::end(const CHIP8& chip8, const Instruction& ins) {
+  const std::chrono::steady_clock::time_point finished {
+    std::chrono::steady_clock::now()};
+  ClassStats& stats {classes[opcode_class(ins.opcode)]};
+  ++stats.count;
+  stats.time += std::chrono::duration_cast<std::chrono::nanoseconds>(
+    finished - started);
+  ++instructions;
+
+  const std::uint64_t tick {chip8.cycles / chip8.cycles_per_tick};
+  if (tick != last_tick) {
+    ++ticks_seen;
+    last_tick = tick;
+  }
+  const std::uint16_t opcode_kind {static_cast<std::uint16_t>(
+    ins.opcode & 0xF000)};
+  if (opcode_kind == 0xD000 || ins.opcode == 0x00E0) {
+    ++(opcode_kind == 0xD000 ? draws : clears);
+    if (tick != last_drawn_tick) {
+      ++ticks_drawn;
+      last_drawn_tick = tick;
+    }
+  }
+
+  // Follow the call stack. Calls nested deeper than the CHIP-8 stack can hold
+  // overwrite return addresses, so they stay attributed to the deepest frame.
+  const bool call {ins.handler == &CPU::op_2NNN
+                   || ins.handler == &CPU::op_0NNN};
+  if (call && depth < MAX_DEPTH) {
+    Frame& caller {frames[current_frame]};
+    const auto callee {caller.callees.find(ins.NNN)};
+    if (callee != caller.callees.end()) {
+      current_frame = callee->second;
+    } else {
+      const std::int32_t index {static_cast<std::int32_t>(frames.size())};
+      caller.callees.emplace(ins.NNN, index);
+      frames.push_back(Frame {current_frame, ins.NNN, 0, {}});
+      current_frame = index;
+    }
+    ++depth;
+  } else if (ins.opcode == 0x00EE && depth > 0) {
+    current_frame = frames[current_frame].parent;
+    --depth;
+  }
+}
+
+std::uint64_t Profiler::instruction_count() const {
+  return instructions;
+}
+
+void Profiler::report(std::ostream& out, std::size_t top) const {
+  std::vector<std::pair<std::uint64_t, std::uint16_t>> hot_classes {};
+  for (std::size_t key {0}; key < classes.size(); ++key) {
+    if (classes[key].count) {
+      hot_classes.emplace_back(classes[key].count,
+                               static_cast<std::uint16_t>(key));
+    }
+  }
+  std::vector<std::pair<std::uint64_t, std::uint16_t>> hot_addresses {};
+  for (std::size_t address {0}; address < addresses.size(); ++address) {
+    if (addresses[address]) {
+      hot_addresses.emplace_back(addresses[address],
+                                 static_cast<std::uint16_t>(address));
+    }
+  }
+  const auto hotter = [](const std::pair<std::uint64_t, std::uint16_t>& lhs,
+                         const std::pair<std::uint64_t, std::uint16_t>& rhs) {
+    return lhs.first != rhs.first ? lhs.first > rhs.first
+                                  : lhs.second < rhs.second;
+  };
+  std::sort(hot_classes.begin(), hot_classes.end(), hotter);
+  std::sort(hot_addresses.begin(), hot_addresses.end(), hotter);
+
+  out << instructions << " instructions profiled\n"
+      << "\nopcode class       count       %   ns/op\n"
+      << std::fixed << std::setfill(' ');
+  for (std::size_t idx {0}; idx < hot_classes.size() && idx < top; ++idx) {
+    const ClassStats& stats {classes[hot_classes[idx].second]};
+    out << "  " << std::left << std::setw(10)
+        << class_name(hot_classes[idx].second) << std::right
+        << std::setw(12) << stats.count
+        << std::setw(7) << std::setprecision(2)
+        << percent(stats.count, instructions)
+        << std::setw(8) << std::setprecision(1)
+        << static_cast<double>(stats.time.count()) / stats.count << '\n';
+  }
+  out << "\naddress  opcode      count       %\n";
+  for (std::size_t idx {0}; idx < hot_addresses.size() && idx < top; ++idx) {
+    const std::uint16_t address {hot_addresses[idx].second};
+    out << "  " << std::hex << std::uppercase << std::setfill('0')
+        << std::setw(3) << address << "    " << std::setw(4)
+        << opcodes[address] << std::dec << std::setfill(' ')
+        << std::setw(11) << hot_addresses[idx].first
+        << std::setw(8) << std::setprecision(2)
+        << percent(hot_addresses[idx].first, instructions) << '\n';
+  }
+  out << "\ndraws: " << draws << " DXYN, " << clears << " 00E0, in "
+      << ticks_drawn << " of " << ticks_seen << " ticks ("
+      << std::setprecision(2) << percent(ticks_drawn, ticks_seen) << "%)\n"
+      << std::defaultfloat;
+}
+
+void Profiler::write_folded(std::ostream& out) const {
+  for (std::size_t idx {0}; idx < frames.size(); ++idx) {
+    if (!frames[idx].samples) {
+      continue;
+    }
+    // Walk up to the entry point, then print the frames outermost first.
+    std::vector<std::uint16_t> stack {};
+    for (std::int32_t frame {static_cast<std::int32_t>(idx)}; frame >= 0;
+         frame = frames[frame].parent) {
+      stack.push_back(frames[frame].address);
+    }
+    for (auto address {stack.rbegin()}; address != stack.rend(); ++address) {
+      out << (address == stack.rbegin() ? "" : ";") << frame_name(*address);
+    }
+    out << ' ' << frames[idx].samples << '\n';
+  }
+}
@@ -0,0 +1,95 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <vector>
+
+#include "instruction.h"
+
+class CHIP8;
+
+// Profiler that records nothing. CHIP8::clock_cycle and CHIP8::run use it
+// unless given another profiler, its empty hooks compile away entirely.
+// SKIPS_IDLE tells CHIP8::run whether it may skip idle loops, which bypasses
+// the hooks; every profiler that records anything sets it to false.
+struct NullProfiler {
+  static constexpr bool SKIPS_IDLE {true};
+  static constexpr bool RUNS_BLOCKS {true};
+
+  void begin(const CHIP8&, std::uint16_t, const Instruction&) {}
+  void end(const CHIP8&, const Instruction&) {}
+};
+
+/*
+ * Collects execution statistics for every instruction interpreted by
+ * CHIP8::clock_cycle:
+ *  - executions and time spent per opcode class (e.g. 8XY4) and per address
+ *  - DXYN and 00E0 counts, and the number of 60 Hz ticks that drew anything
+ *  - instructions executed per call stack, following 2NNN, 0NNN (which this
+ *    emulator runs as a call) and 00EE
+ * Blocks run by the Translator would bypass clock_cycle, so a profiled run
+ * interprets every instruction whatever the execution mode. Idle loops are
+ * interpreted rather than skipped while profiling, so they show up with
+ * every cycle they burn.
+ */
+class Profiler {
+public:
+  static constexpr bool SKIPS_IDLE {false};
+  static constexpr bool RUNS_BLOCKS {false};
+
+  struct ClassStats {
+    std::uint64_t count;
+    std::chrono::nanoseconds time;
+  };
+
+public:
+  Profiler();
+  void begin(const CHIP8& chip8, std::uint16_t address, const Instruction& ins);
+  void end(const CHIP8& chip8, const Instruction& ins);
+  // Number of instructions recorded so far.
+  std::uint64_t instruction_count() const;
+  // Writes the opcode classes and addresses sorted by execution count,
+  // limited to the top entries of each, followed by the draw statistics.
+  void report(std::ostream& out, std::size_t top) const;
+  // Writes one "frame;frame;frame count" line per call stack, the format read
+  // by flamegraph.pl. Frames are named after the subroutine address.
+  void write_folded(std::ostream& out) const;
+
+private:
+  // A call stack, identified by its innermost subroutine and its caller.
+  struct Frame {
+    std::int32_t parent; // -1 for the program entry point
+    std::uint16_t address; // first instruction of the subroutine
+    std::uint64_t samples; // instructions executed in this exact stack
+    std::map<std::uint16_t, std::int32_t> callees;
+  };
+
+  // Deepest call stack tracked, the CHIP-8 stack holds 16 return addresses.
+  static constexpr std::size_t MAX_DEPTH {16};
+
+private:
+  // Indexed by the opcode with its operand fields masked out.
+  std::vector<ClassStats> classes;
+  std::array<std::uint64_t, 0x1000> addresses;
+  std::array<std::uint16_t, 0x1000> opcodes; // last opcode seen per address
+  std::uint64_t instructions;
+  std::uint64_t draws;
+  std::uint64_t clears;
+  // 60 Hz timer ticks elapsed while profiling, and those in which the program
+  // drew at least once.
+  std::uint64_t ticks_seen;
+  std::uint64_t ticks_drawn;
+  std::uint64_t last_tick;
+  std::uint64_t last_drawn_tick;
+  std::vector<Frame> frames;
+  std::int32_t current_frame;
+  std::size_t depth;
+  std::chrono::steady_clock::time_point started;
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,39 @@
+#include "quirks.h"
+
+#include <stdexcept>
+#include <string>
+
+constexpr QuirkProfile Chip8Quirks::PROFILE;
+constexpr bool Chip8Quirks::SHIFT_READS_VY;
+constexpr bool Chip8Quirks::JUMP_ADDS_VX;
+constexpr bool Chip8Quirks::CLIP_SPRITES;
+constexpr QuirkProfile Chip48Quirks::PROFILE;
+constexpr bool Chip48Quirks::SHIFT_READS_VY;
+constexpr bool Chip48Quirks::JUMP_ADDS_VX;
+constexpr bool Chip48Quirks::CLIP_SPRITES;
+constexpr QuirkProfile SuperChipQuirks::PROFILE;
+constexpr bool SuperChipQuirks::SHIFT_READS_VY;
+constexpr bool SuperChipQuirks::JUMP_ADDS_VX;
+constexpr bool SuperChipQuirks::CLIP_SPRITES;
+
+QuirkProfile parse_quirk_profile(const std::string& name) {
+  if (name == "chip8") {
+    return QuirkProfile::CHIP8;
+  }
+  if (name == "chip48") {
+    return QuirkProfile::CHIP48;
+  }
+  if (name == "schip") {
+    return QuirkProfile::SUPER_CHIP;
+  }
+  throw std::invalid_argument("Unknown quirk profile: " + name);
+}
+
+std::string quirk_profile_name(QuirkProfile profile) {
+  switch (profile) {
+    case QuirkProfile::CHIP48: return "chip48";
+    case QuirkProfile::SUPER_CHIP: return "schip";
+    case QuirkProfile::CHIP8: break;
+  }
+  return "chip8";
+}
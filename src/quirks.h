@@ -0,0 +1,66 @@
+#ifndef QUIRKS_H
+#define QUIRKS_H
+
+#include <cstdint>
+#include <string>
+
+// Interpreters whose instruction semantics CHIP8 can follow. ROMs written for
+// one of them may misbehave under the others.
+enum class QuirkProfile {
+  CHIP8, // the behaviour described in misc/ops.txt
+  CHIP48, // CHIP-48 on the HP-48
+  SUPER_CHIP // SUPER-CHIP 1.1
+};
+
+/*
+ * Compile-time quirk policies. The handlers whose behaviour differs between
+ * interpreters take one of these as a template parameter, so every profile
+ * gets its own handlers and dispatch table and no handler ever tests a quirk
+ * flag at runtime. Each policy describes:
+ *  - SHIFT_READS_VY: 8XY6/8XYE shift VY into VX instead of shifting VX
+ *  - index_after_load_store: the value of I after FX55/FX65
+ *  - JUMP_ADDS_VX: BNNN jumps to NNN + VX (X being the top nibble of NNN)
+ *    instead of NNN + V0
+ *  - CLIP_SPRITES: DXYN drops the pixels past the edges of the display
+ *    instead of wrapping them around
+ */
+struct Chip8Quirks {
+  static constexpr QuirkProfile PROFILE {QuirkProfile::CHIP8};
+  static constexpr bool SHIFT_READS_VY {true};
+  static constexpr std::uint16_t index_after_load_store(std::uint16_t I,
+                                                        std::uint8_t X) {
+    return static_cast<std::uint16_t>(I + X + 1);
+  }
+  static constexpr bool JUMP_ADDS_VX {false};
+  static constexpr bool CLIP_SPRITES {false};
+};
+
+struct Chip48Quirks {
+  static constexpr QuirkProfile PROFILE {QuirkProfile::CHIP48};
+  static constexpr bool SHIFT_READS_VY {false};
+  static constexpr std::uint16_t index_after_load_store(std::uint16_t I,
+                                                        std::uint8_t X) {
+    return static_cast<std::uint16_t>(I + X);
+  }
+  static constexpr bool JUMP_ADDS_VX {true};
+  static constexpr bool CLIP_SPRITES {true};
+};
+
+struct SuperChipQuirks {
+  static constexpr QuirkProfile PROFILE {QuirkProfile::SUPER_CHIP};
+  static constexpr bool SHIFT_READS_VY {false};
+  static constexpr std::uint16_t index_after_load_store(std::uint16_t I,
+                                                        std::uint8_t) {
+    return I;
+  }
+  static constexpr bool JUMP_ADDS_VX {true};
+  static constexpr bool CLIP_SPRITES {true};
+};
+
+// Parses "chip8", "chip48" or "schip". Throws std::invalid_argument for any
+// other name.
+QuirkProfile parse_quirk_profile(const std::string& name);
+// The name parse_quirk_profile accepts for the profile.
+std::string quirk_profile_name(QuirkProfile profile);
+
+#endif // QUIRKS_H
@@ -0,0 +1,53 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+/*
+ * PCG32 (PCG-XSH-RR with 64-bit state), a small and fast generator with good
+ * statistical quality. Besides the seed it takes a stream number: generators
+ * seeded alike but given different streams produce independent sequences, so
+ * every instance of a batch can draw its own numbers from a single seed.
+ * The whole state is the two public words, which snapshots and input logs
+ * store as they are.
+ */
+class Pcg32 {
+public:
+  static constexpr std::uint64_t MULTIPLIER {6364136223846793005ull};
+
+public:
+  Pcg32() : Pcg32(0, 0) {}
+  Pcg32(std::uint64_t seed, std::uint64_t stream)
+    : state {0}, increment {(stream << 1) | 1u} {
+    next();
+    state += seed;
+    next();
+  }
+
+  std::uint32_t next() {
+    const std::uint64_t old {state};
+    state = old * MULTIPLIER + increment;
+    const std::uint32_t xorshifted {
+      static_cast<std::uint32_t>(((old >> 18) ^ old) >> 27)};
+    const std::uint32_t rotation {static_cast<std::uint32_t>(old >> 59)};
+    return (xorshifted >> rotation) | (xorshifted << ((32 - rotation) & 31));
+  }
+
+  std::uint64_t stream() const {
+    return increment >> 1;
+  }
+
+  bool operator==(const Pcg32& other) const {
+    return state == other.state && increment == other.increment;
+  }
+
+  bool operator!=(const Pcg32& other) const {
+    return !(*this == other);
+  }
+
+public:
+  std::uint64_t state;
+  std::uint64_t increment; // always odd, selects the stream
+};
+
+#endif // RNG_H
@@ -0,0 +1,101 @@
+#include "rom.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <ios>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CHIP8_HAS_MMAP 1
+#endif
+
+namespace {
+void check_size(std::size_t size) {
+  if (size > RomImage::MAX_SIZE) {
+    throw std::invalid_argument(
+      "The ROM is too large for the CHIP-8 interpreter.");
+  }
+}
+} // namespace
+
+constexpr std::size_t RomImage::MAX_SIZE;
+
+RomImage::RomImage(const std::string& file_loc)
+  : mapping {nullptr}, mapping_size {0}, buffer {} {
+#if defined(CHIP8_HAS_MMAP)
+  const int fd {open(file_loc.c_str(), O_RDONLY)};
+  if (fd < 0) {
+    throw std::runtime_error("File could not be found.");
+  }
+  struct stat info {};
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    throw std::runtime_error("File could not be read.");
+  }
+  const std::size_t size {static_cast<std::size_t>(info.st_size)};
+  try {
+    // Validate before mapping or copying anything.
+    check_size(size);
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+  if (size > 0) {
+    void* address {mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)};
+    if (address == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("File could not be mapped.");
+    }
+    mapping = address;
+    mapping_size = size;
+  }
+  // The mapping stays valid after the descriptor is closed.
+  close(fd);
+#else
+  std::ifstream rom {file_loc, std::ios::binary | std::ios::ate};
+  if (!rom) {
+    throw std::runtime_error("File could not be found.");
+  }
+  check_size(static_cast<std::size_t>(rom.tellg()));
+  rom.seekg(0);
+  buffer.assign(std::istreambuf_iterator<char>{rom}, {});
+#endif
+}
+
+RomImage::RomImage(const std::uint8_t* bytes, std::size_t length)
+  : mapping {nullptr}, mapping_size {0}, buffer {} {
+  check_size(length);
+  buffer.assign(bytes, bytes + length);
+}
+
+RomImage::RomImage(RomImage&& other) noexcept
+  : mapping {other.mapping}, mapping_size {other.mapping_size},
+    buffer {std::move(other.buffer)} {
+  other.mapping = nullptr;
+  other.mapping_size = 0;
+}
+
+RomImage::~RomImage() {
+#if defined(CHIP8_HAS_MMAP)
+  if (mapping) {
+    munmap(mapping, mapping_size);
+  }
+#endif
+}
+
+const std::uint8_t* RomImage::data() const {
+  return mapping ? static_cast<const std::uint8_t*>(mapping) : buffer.data();
+}
+
+std::size_t RomImage::size() const {
+  return mapping ? mapping_size : buffer.size();
+}
@@ -0,0 +1,40 @@
+#ifndef ROM_H
+#define ROM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * A validated ROM image that can be loaded into any number of CHIP8
+ * instances without reading the file again. Files are memory-mapped where
+ * the platform supports it, so the only copy made is the one into each
+ * instance's memory.
+ */
+class RomImage {
+public:
+  // Programs are loaded at 0x200 and may fill the memory up to 0xFFF.
+  static constexpr std::size_t MAX_SIZE {0x1000 - 0x200};
+
+public:
+  // Throws std::runtime_error if the file cannot be read and
+  // std::invalid_argument if it does not fit into memory.
+  explicit RomImage(const std::string& file_loc);
+  // Copies a ROM that is already in memory.
+  RomImage(const std::uint8_t* bytes, std::size_t length);
+  RomImage(RomImage&& other) noexcept;
+  RomImage(const RomImage&) = delete;
+  RomImage& operator=(const RomImage&) = delete;
+  RomImage& operator=(RomImage&&) = delete;
+  ~RomImage();
+  const std::uint8_t* data() const;
+  std::size_t size() const;
+
+private:
+  void* mapping; // nullptr unless the file is memory-mapped
+  std::size_t mapping_size;
+  std::vector<std::uint8_t> buffer; // holds the ROM if it is not mapped
+};
+
+#endif // ROM_H
@@ -0,0 +1,135 @@
+#include "snapshot.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+/*
+ * Layout of a serialized snapshot, all integers little-endian:
+ *   "C8SS" magic, 1 byte format version
+ *   V0-VF, pc, I, stack_pointer, stack, display, delay_timer, sound_timer,
+ *   keypad, waiting_for_key, wait_held_keys, rng state and increment, cycles
+ *   per page: 1 byte tag (0 = all zeros, 1 = raw) followed by the raw bytes
+ */
+namespace {
+constexpr std::array<std::uint8_t, 4> MAGIC {'C', '8', 'S', 'S'};
+constexpr std::uint8_t VERSION {3};
+constexpr std::uint8_t ZERO_PAGE {0};
+constexpr std::uint8_t RAW_PAGE {1};
+
+template <typename T>
+void put(std::vector<std::uint8_t>& out, T value) {
+  for (std::size_t byte {0}; byte < sizeof(T); ++byte) {
+    out.push_back(static_cast<std::uint8_t>(value >> (8 * byte)));
+  }
+}
+
+class Reader {
+public:
+  explicit Reader(const std::vector<std::uint8_t>& bytes)
+    : data {bytes}, pos {0} {}
+
+  template <typename T>
+  T get() {
+    if (data.size() - pos < sizeof(T)) {
+      throw std::invalid_argument("The snapshot is truncated.");
+    }
+    T value {0};
+    for (std::size_t byte {0}; byte < sizeof(T); ++byte) {
+      value |= static_cast<T>(static_cast<T>(data[pos++]) << (8 * byte));
+    }
+    return value;
+  }
+
+private:
+  const std::vector<std::uint8_t>& data;
+  std::size_t pos;
+};
+} // namespace
+
+constexpr std::size_t Snapshot::PAGE_SIZE;
+constexpr std::size_t Snapshot::PAGE_COUNT;
+
+std::vector<std::uint8_t> Snapshot::serialize() const {
+  std::vector<std::uint8_t> out {MAGIC.begin(), MAGIC.end()};
+  out.push_back(VERSION);
+  out.insert(out.end(), V.begin(), V.end());
+  put(out, pc);
+  put(out, I);
+  put(out, stack_pointer);
+  for (const std::uint16_t address : stack) {
+    put(out, address);
+  }
+  for (const std::uint64_t row : display) {
+    put(out, row);
+  }
+  put(out, delay_timer);
+  put(out, sound_timer);
+  put(out, keypad);
+  put(out, static_cast<std::uint8_t>(waiting_for_key));
+  put(out, wait_held_keys);
+  put(out, rng.state);
+  put(out, rng.increment);
+  put(out, cycles);
+  for (const std::shared_ptr<const Page>& page : pages) {
+    if (std::all_of(page->begin(), page->end(),
+                    [](std::uint8_t byte) { return byte == 0; })) {
+      out.push_back(ZERO_PAGE);
+    } else {
+      out.push_back(RAW_PAGE);
+      out.insert(out.end(), page->begin(), page->end());
+    }
+  }
+  return out;
+}
+
+Snapshot Snapshot::deserialize(const std::vector<std::uint8_t>& data) {
+  Reader reader {data};
+  for (const std::uint8_t expected : MAGIC) {
+    if (reader.get<std::uint8_t>() != expected) {
+      throw std::invalid_argument("The data is not a CHIP-8 snapshot.");
+    }
+  }
+  if (reader.get<std::uint8_t>() != VERSION) {
+    throw std::invalid_argument("Unsupported snapshot version.");
+  }
+  Snapshot snapshot {};
+  for (std::uint8_t& reg : snapshot.V) {
+    reg = reader.get<std::uint8_t>();
+  }
+  snapshot.pc = reader.get<std::uint16_t>();
+  snapshot.I = reader.get<std::uint16_t>();
+  snapshot.stack_pointer = reader.get<std::uint8_t>();
+  for (std::uint16_t& address : snapshot.stack) {
+    address = reader.get<std::uint16_t>();
+  }
+  for (std::uint64_t& row : snapshot.display) {
+    row = reader.get<std::uint64_t>();
+  }
+  snapshot.delay_timer = reader.get<std::uint8_t>();
+  snapshot.sound_timer = reader.get<std::uint8_t>();
+  snapshot.keypad = reader.get<std::uint16_t>();
+  snapshot.waiting_for_key = reader.get<std::uint8_t>() != 0;
+  snapshot.wait_held_keys = reader.get<std::uint16_t>();
+  snapshot.rng.state = reader.get<std::uint64_t>();
+  snapshot.rng.increment = reader.get<std::uint64_t>();
+  snapshot.cycles = reader.get<std::uint64_t>();
+  for (std::shared_ptr<const Page>& page : snapshot.pages) {
+    std::shared_ptr<Page> contents {std::make_shared<Page>()};
+    contents->fill(0);
+    const std::uint8_t tag {reader.get<std::uint8_t>()};
+    if (tag == RAW_PAGE) {
+      for (std::uint8_t& byte : *contents) {
+        byte = reader.get<std::uint8_t>();
+      }
+    } else if (tag != ZERO_PAGE) {
+      throw std::invalid_argument("The snapshot contains an invalid page.");
+    }
+    page = contents;
+  }
+  return snapshot;
+}
@@ -0,0 +1,48 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "rng.h"
+
+/*
+ * The complete state of a CHIP8 at one point in time, see CHIP8::snapshot.
+ * Memory is split into pages which are shared between consecutive snapshots
+ * of the same machine until the program writes to them (copy-on-write), so
+ * taking a snapshot only copies the pages written since the previous one.
+ */
+class Snapshot {
+public:
+  static constexpr std::size_t PAGE_SIZE {256};
+  static constexpr std::size_t PAGE_COUNT {4096 / PAGE_SIZE};
+  using Page = std::array<std::uint8_t, PAGE_SIZE>;
+
+public:
+  std::array<std::uint8_t, 16> V;
+  std::uint16_t pc;
+  std::uint16_t I;
+  std::uint8_t stack_pointer;
+  std::array<std::uint16_t, 16> stack;
+  std::array<std::uint64_t, 32> display;
+  std::uint8_t delay_timer;
+  std::uint8_t sound_timer;
+  std::uint16_t keypad;
+  bool waiting_for_key;
+  std::uint16_t wait_held_keys;
+  Pcg32 rng;
+  std::uint64_t cycles;
+  std::array<std::shared_ptr<const Page>, PAGE_COUNT> pages;
+
+public:
+  // Encodes the snapshot into a self-contained binary format in which pages
+  // that only hold zeros take up a single byte.
+  std::vector<std::uint8_t> serialize() const;
+  // Throws std::invalid_argument if data is not a serialized snapshot.
+  static Snapshot deserialize(const std::vector<std::uint8_t>& data);
+};
+
+#endif // SNAPSHOT_H
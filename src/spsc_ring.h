@@ -0,0 +1,63 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+/*
+ * A bounded lock-free queue for exactly one producer thread and one consumer
+ * thread. Neither side ever blocks: try_push fails when the ring is full and
+ * try_pop when it is empty, leaving it to the caller to drop, retry or wait.
+ * The read and write positions live on separate cache lines so the two
+ * threads do not contend for the same line.
+ */
+template <typename T, std::size_t Capacity>
+class SpscRing {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                "The capacity of a ring must be a power of two.");
+
+public:
+  SpscRing() : slots {}, head {0}, padding {}, tail {0} {}
+  SpscRing(const SpscRing&) = delete;
+  SpscRing& operator=(const SpscRing&) = delete;
+
+  // Producer only. Returns false without copying if the ring is full.
+  bool try_push(const T& value) {
+    const std::size_t write {tail.load(std::memory_order_relaxed)};
+    if (write - head.load(std::memory_order_acquire) == Capacity) {
+      return false;
+    }
+    slots[write & (Capacity - 1)] = value;
+    tail.store(write + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only. Returns false without touching value if the ring is empty.
+  bool try_pop(T& value) {
+    const std::size_t read {head.load(std::memory_order_relaxed)};
+    if (read == tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    value = slots[read & (Capacity - 1)];
+    head.store(read + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Only exact while neither side is running.
+  bool empty() const {
+    return head.load(std::memory_order_acquire)
+           == tail.load(std::memory_order_acquire);
+  }
+
+private:
+  std::array<T, Capacity> slots;
+  // Both positions only ever grow, the slot is the position modulo Capacity.
+  std::atomic<std::size_t> head; // next slot to read
+  // Keeps tail off the cache line of head. Padding rather than alignas, as
+  // C++11 operator new does not honour extended alignment.
+  char padding[64];
+  std::atomic<std::size_t> tail; // next slot to write
+};
+
+#endif // SPSC_RING_H
@@ -0,0 +1,250 @@
+#include "translator.h"
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "chip8.h"
+#include "cpu.h"
+#include "instruction.h"
+#include "quirks.h"
+#include "rom.h"
+
+namespace {
+/**
+ *  ANNN+DXYN Store NNN in register I, then draw a sprite at position VX, VY
+ *            with N bytes of sprite data starting at the address stored in I
+ */
+template <typename Quirks>
+void op_ANNN_DXYN(CHIP8* chip8, const Instruction& ins) {
+  CPU::op_ANNN(chip8, ins);
+  CPU::op_DXYN<Quirks>(chip8, ins);
+}
+
+/*
+ * Operations that jump to a computed address or write to memory (and may
+ * therefore modify the block itself) end a block.
+ */
+template <typename Quirks>
+bool ends_block(const Instruction::Handler handler) {
+  return handler == &CPU::op_00EE || handler == &CPU::op_BNNN<Quirks>
+         || handler == &CPU::op_FX33 || handler == &CPU::op_FX55<Quirks>;
+}
+
+// The timers only count down between blocks, so these have to come first.
+bool uses_timers(const Instruction::Handler handler) {
+  return handler == &CPU::op_FX07 || handler == &CPU::op_FX15
+         || handler == &CPU::op_FX18;
+}
+
+bool is_jump_or_call(const Instruction::Handler handler) {
+  return handler == &CPU::op_1NNN || handler == &CPU::op_2NNN
+         || handler == &CPU::op_0NNN;
+}
+
+template <typename T>
+bool matches(std::ostream& report, const char* field, const T& interpreted,
+             const T& translated) {
+  if (interpreted != translated) {
+    report << "Mismatch in " << field << " between the interpreter and the "
+           << "block translator.\n";
+    return false;
+  }
+  return true;
+}
+} // namespace
+
+constexpr std::size_t Translator::MAX_BLOCK_LENGTH;
+constexpr std::size_t Translator::BLOCK_CAPACITY;
+constexpr std::size_t Translator::OP_CAPACITY;
+
+Translator::Translator()
+  : blocks {}, ops {}, block_count {0}, op_count {0}, block_index {},
+    covered {} {
+  block_index.fill(-1);
+}
+
+/**
+ * Runs from one block into the next as long as control moves forward, so that
+ * the caller only gets to look for idle loops where a backward jump happened.
+ */
+std::size_t Translator::execute(CHIP8* chip8, std::size_t budget) {
+  std::size_t executed {0};
+  for (;;) {
+    const std::uint16_t start {chip8->pc};
+    if (start < 0x200 || start > 0xFFE) {
+      return executed;
+    }
+    std::int32_t idx {block_index[start - 0x200]};
+    if (idx < 0) {
+      idx = lookup(*chip8, start);
+    }
+    const Block& block {blocks[idx]};
+    if (block.length > budget - executed) {
+      return executed;
+    }
+    executed += run_block(chip8, block);
+    if (chip8->pc <= start) {
+      return executed;
+    }
+  }
+}
+
+std::size_t Translator::run_block(CHIP8* chip8, const Block& block) {
+  const Op* op {&ops[block.first_op]};
+  for (const Op* const end {op + block.op_count}; op != end; ++op) {
+    chip8->pc = op->next;
+    op->ins.handler(chip8, op->ins);
+    if (chip8->pc != op->expected) {
+      chip8->tick(op->count);
+      return op->count;
+    }
+  }
+  // The exit may write to memory and flush the block it belongs to, so
+  // nothing may be read from the block after it ran.
+  const std::size_t length {block.length};
+  const Instruction exit {block.exit};
+  chip8->pc = block.exit_pc;
+  if (exit.handler) {
+    exit.handler(chip8, exit);
+  }
+  chip8->tick(length);
+  return length;
+}
+
+/**
+ * Allocates the storage on first use, and starts over once a block of the
+ * maximum length might no longer fit.
+ */
+std::int32_t Translator::lookup(const CHIP8& chip8, std::uint16_t start) {
+  if (blocks.empty()) {
+    blocks.resize(BLOCK_CAPACITY);
+    ops.resize(OP_CAPACITY);
+  }
+  if (block_count == BLOCK_CAPACITY
+      || op_count + MAX_BLOCK_LENGTH > OP_CAPACITY) {
+    flush();
+  }
+  Block& block {blocks[block_count]};
+  switch (chip8.quirks) {
+    case QuirkProfile::CHIP8: translate<Chip8Quirks>(chip8, start, block);
+      break;
+    case QuirkProfile::CHIP48: translate<Chip48Quirks>(chip8, start, block);
+      break;
+    case QuirkProfile::SUPER_CHIP:
+      translate<SuperChipQuirks>(chip8, start, block);
+      break;
+  }
+  const std::int32_t idx {static_cast<std::int32_t>(block_count++)};
+  block_index[start - 0x200] = idx;
+  return idx;
+}
+
+template <typename Quirks>
+void Translator::translate(const CHIP8& chip8, std::uint16_t start,
+                           Block& block) {
+  block = Block {static_cast<std::uint16_t>(op_count), 0, 0, start,
+                 Instruction {}};
+  std::uint16_t address {start};
+  while (block.length < MAX_BLOCK_LENGTH && address <= 0xFFE) {
+    Instruction ins {CPU::decode<Quirks>(chip8.fetch(address))};
+    if (block.length && uses_timers(ins.handler)) {
+      break;
+    }
+    covered.set(address);
+    covered.set(address + 1);
+    const std::uint16_t next {static_cast<std::uint16_t>(address + 2)};
+    address = next;
+    ++block.length;
+    const bool fixed_target {is_jump_or_call(ins.handler) && ins.NNN >= 0x200};
+    if (ends_block<Quirks>(ins.handler)
+        || (is_jump_or_call(ins.handler) && !fixed_target)) {
+      block.exit = ins;
+      break;
+    }
+    if (fixed_target) {
+      address = ins.NNN;
+      if (ins.handler == &CPU::op_1NNN) {
+        // Nothing left to do at runtime.
+        continue;
+      }
+    }
+    Op* const last {block.op_count ? &ops[op_count - 1] : nullptr};
+    if (last && ins.handler == &CPU::op_7XNN
+        && last->ins.handler == &CPU::op_6XNN && last->ins.X == ins.X) {
+      last->ins.NN = static_cast<std::uint8_t>(last->ins.NN + ins.NN);
+      last->count = block.length;
+      continue;
+    }
+    if (last && ins.handler == &CPU::op_DXYN<Quirks>
+        && last->ins.handler == &CPU::op_ANNN) {
+      ins.NNN = last->ins.NNN;
+      ins.handler = &op_ANNN_DXYN<Quirks>;
+      last->ins = ins;
+      last->count = block.length;
+      continue;
+    }
+    ops[op_count++] = Op {ins, next, address, block.length};
+    ++block.op_count;
+  }
+  block.exit_pc = address;
+}
+
+void Translator::invalidate(std::uint16_t address, std::size_t length) {
+  for (std::size_t offset {0}; offset < length; ++offset) {
+    if (covered.test((address + offset) & 0xFFF)) {
+      flush();
+      return;
+    }
+  }
+}
+
+void Translator::warm(const CHIP8& chip8, std::uint16_t address) {
+  if (address >= 0x200 && address <= 0xFFE
+      && block_index[address - 0x200] < 0) {
+    lookup(chip8, address);
+  }
+}
+
+void Translator::flush() {
+  block_count = 0;
+  op_count = 0;
+  block_index.fill(-1);
+  covered.reset();
+}
+
+bool verify_translation(const std::string& file_loc, QuirkProfile quirks,
+                        std::size_t cycles, std::ostream& report) {
+  const RomImage rom {file_loc};
+  CHIP8 interpreted {rom};
+  CHIP8 translated {rom};
+  interpreted.set_quirks(quirks);
+  translated.set_quirks(quirks);
+  translated.mode = ExecutionMode::BLOCKS;
+  // Both machines have to draw the same random numbers.
+  translated.rng = interpreted.rng;
+  interpreted.run(cycles);
+  translated.run(cycles);
+  bool identical {true};
+  identical &= matches(report, "V", interpreted.V, translated.V);
+  identical &= matches(report, "I", interpreted.I, translated.I);
+  identical &= matches(report, "pc", interpreted.pc, translated.pc);
+  identical &= matches(report, "stack", interpreted.stack, translated.stack);
+  identical &= matches(report, "stack_pointer", interpreted.stack_pointer,
+                       translated.stack_pointer);
+  identical &= matches(report, "mem", interpreted.mem, translated.mem);
+  identical &= matches(report, "display", interpreted.display,
+                       translated.display);
+  identical &= matches(report, "delay_timer", interpreted.delay_timer,
+                       translated.delay_timer);
+  identical &= matches(report, "sound_timer", interpreted.sound_timer,
+                       translated.sound_timer);
+  identical &= matches(report, "rng", interpreted.rng, translated.rng);
+  identical &= matches(report, "cycles", interpreted.cycles,
+                       translated.cycles);
+  return identical;
+}
@@ -0,0 +1,112 @@
+#ifndef TRANSLATOR_H
+#define TRANSLATOR_H
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "instruction.h"
+#include "quirks.h"
+
+class CHIP8;
+
+/*
+ * Translates runs of CHIP-8 instructions into blocks of predecoded
+ * instructions (threaded code) that execute without the interpreter's
+ * per-instruction bookkeeping: the timers are ticked once per block.
+ *  - Jumps and calls to a fixed address in the program area are followed, so
+ *    a block continues at their target.
+ *  - Skips and FX0A stay inside a block; when one changes the program
+ *    counter the block is left there (a side exit).
+ *  - A block ends with the first instruction that jumps to a computed
+ *    address (00EE, BNNN) or writes to memory (FX33, FX55), which may modify
+ *    the block itself, and before an instruction that accesses the timers
+ *    unless it is the first of the block, so that it observes the same timer
+ *    values as in the interpreter.
+ * Common instruction pairs are fused into superinstructions:
+ *  - 6XNN followed by 7XNN on the same register collapses into one 6XNN
+ *  - ANNN followed by DXYN becomes a single load-and-draw
+ * Every operation still runs through the handlers in CPU, so the results are
+ * identical to the interpreter.
+ *
+ * Blocks are looked up by their start address in a table, and their
+ * instructions live in storage of fixed capacity allocated on first use.
+ * When the storage is full, every block is dropped and translation starts
+ * over.
+ */
+class Translator {
+public:
+  // Longest run of instructions translated into a single block.
+  static constexpr std::size_t MAX_BLOCK_LENGTH {64};
+  // Blocks and instructions held before the translator starts over.
+  static constexpr std::size_t BLOCK_CAPACITY {512};
+  static constexpr std::size_t OP_CAPACITY {4096};
+
+public:
+  Translator();
+  // Executes the blocks starting at the current program counter until one
+  // jumps backwards or the next one is longer than what is left of budget,
+  // and returns the number of instructions executed. Returns 0 without
+  // executing anything if the first block is longer than budget or pc lies
+  // outside of the program area, in which case the caller should interpret
+  // one instruction.
+  std::size_t execute(CHIP8* chip8, std::size_t budget);
+  // Drops every block if any of them overlaps [address, address + length).
+  void invalidate(std::uint16_t address, std::size_t length);
+  void flush();
+  // Translates the block starting at address ahead of time, so that execute
+  // finds it ready.
+  void warm(const CHIP8& chip8, std::uint16_t address);
+
+private:
+  // An instruction of a block body. pc is set to next before it runs; if it
+  // leaves pc anywhere but expected, the block is left after count
+  // instructions.
+  struct Op {
+    Instruction ins;
+    std::uint16_t next;
+    std::uint16_t expected;
+    std::uint16_t count;
+  };
+
+  struct Block {
+    std::uint16_t first_op; // index of the first Op in ops
+    std::uint16_t op_count;
+    std::uint16_t length; // number of CHIP-8 instructions covered
+    std::uint16_t exit_pc; // pc once the body ran to its end
+    Instruction exit; // terminating operation, handler is nullptr if none
+  };
+
+private:
+  // Executes block and returns the number of instructions executed.
+  std::size_t run_block(CHIP8* chip8, const Block& block);
+  // Returns the index of the block starting at start, translating it with
+  // the handlers of the machine's quirk profile if necessary.
+  std::int32_t lookup(const CHIP8& chip8, std::uint16_t start);
+  template <typename Quirks>
+  void translate(const CHIP8& chip8, std::uint16_t start, Block& block);
+
+private:
+  std::vector<Block> blocks; // BLOCK_CAPACITY entries once used
+  std::vector<Op> ops; // OP_CAPACITY entries once used
+  std::size_t block_count;
+  std::size_t op_count;
+  // Index into blocks for each start address from 0x200, -1 if untranslated.
+  std::array<std::int32_t, 0xE00> block_index;
+  // Addresses covered by at least one translated block.
+  std::bitset<0x1000> covered;
+};
+
+// Runs the ROM with the given quirk profile for the given number of cycles
+// once with the interpreter and once with the block translator, then compares
+// V, I, pc, the stack, mem, display and the timers of both machines. Any
+// mismatch is written to report. Returns true if both machines reached
+// identical states.
+bool verify_translation(const std::string& file_loc, QuirkProfile quirks,
+                        std::size_t cycles, std::ostream& report);
+
+#endif // TRANSLATOR_H
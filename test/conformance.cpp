@@ -0,0 +1,1265 @@
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "analyzer.h"
+#include "arena.h"
+#include "batch.h"
+#include "capture.h"
+#include "chip8.h"
+#include "cpu.h"
+#include "input_log.h"
+#include "instruction.h"
+#include "libchip8.h"
+#include "profiler.h"
+#include "quirks.h"
+#include "rng.h"
+#include "rom.h"
+#include "snapshot.h"
+
+/*
+ * Conformance tests for the CPU core. The reference interpreter below
+ * fetches, decodes and executes one instruction at a time without any of the
+ * fast paths; everything else is checked against it or against golden values.
+ * Each test is selected by name so that ctest reports them separately, and
+ * writes what differs to stdout:
+ *   opcodes     golden vectors for every CPU::op_* handler and quirk profile
+ *   bc_test     full runs of test/BC_test.ch8, compared with the screen
+ *               it ends on under each profile
+ *   predecoder  the interpreter with its instruction cache, cold and warmed
+ *               up by the analyzer
+ *   blocks      the block translator, cold and warmed up
+ *   lanes       every lane of LockstepBatch
+ *   idle        idle loop skipping at several clock rates
+ *   profiler    profiled runs, which have to record every cycle
+ *   snapshot    copy-on-write snapshots, restored and serialized
+ *   replay      input logs recorded and replayed
+ *   capture     frame captures encoded and decoded
+ *   analyzer    problems the static analysis reports, and its listing
+ *   c_abi       the C interface against the C++ one
+ *   arena       machines recycled by MachineArena
+ */
+namespace {
+const std::vector<QuirkProfile> PROFILES {
+  QuirkProfile::CHIP8, QuirkProfile::CHIP48, QuirkProfile::SUPER_CHIP};
+constexpr std::uint64_t SEED {0x5EED};
+
+/**
+ * Executes one instruction the plain way, with no instruction cache,
+ * translation or idle loop skipping.
+ */
+void reference_step(CHIP8& chip8) {
+  const std::uint16_t address {static_cast<std::uint16_t>(chip8.pc & 0xFFF)};
+  chip8.pc += 2;
+  const Instruction ins {CPU::decode(chip8.fetch(address), chip8.quirks)};
+  ins.handler(&chip8, ins);
+  chip8.tick(1);
+}
+
+template <typename T>
+bool same(const std::string& context, const char* field, const T& expected,
+          const T& actual) {
+  if (expected != actual) {
+    std::cout << context << ": " << field << " differs\n";
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Compares everything a program can observe or that decides what it does
+ * next. Reports each field that differs.
+ */
+bool same_state(const std::string& context, const CHIP8& expected,
+                const CHIP8& actual) {
+  bool identical {true};
+  identical &= same(context, "V", expected.V, actual.V);
+  identical &= same(context, "pc", expected.pc, actual.pc);
+  identical &= same(context, "I", expected.I, actual.I);
+  identical &= same(context, "stack_pointer", expected.stack_pointer,
+                    actual.stack_pointer);
+  identical &= same(context, "stack", expected.stack, actual.stack);
+  identical &= same(context, "delay_timer", expected.delay_timer,
+                    actual.delay_timer);
+  identical &= same(context, "sound_timer", expected.sound_timer,
+                    actual.sound_timer);
+  identical &= same(context, "waiting_for_key", expected.waiting_for_key,
+                    actual.waiting_for_key);
+  identical &= same(context, "wait_held_keys", expected.wait_held_keys,
+                    actual.wait_held_keys);
+  identical &= same(context, "dirty_rows", expected.dirty_rows,
+                    actual.dirty_rows);
+  identical &= same(context, "tick_countdown", expected.tick_countdown,
+                    actual.tick_countdown);
+  identical &= same(context, "cycles", expected.cycles, actual.cycles);
+  identical &= same(context, "mem", expected.mem, actual.mem);
+  identical &= same(context, "dirty_pages", expected.dirty_pages,
+                    actual.dirty_pages);
+  identical &= same(context, "display", expected.display, actual.display);
+  identical &= same(context, "rng", expected.rng, actual.rng);
+  identical &= same(context, "unknown_operations", expected.unknown_operations,
+                    actual.unknown_operations);
+  identical &= same(context, "last_unknown_opcode",
+                    expected.last_unknown_opcode, actual.last_unknown_opcode);
+  return identical;
+}
+
+// Puts a fresh machine into the same configuration as every other machine
+// of a comparison.
+void configure(CHIP8& chip8, QuirkProfile profile, std::uint32_t hz,
+               std::uint64_t stream) {
+  chip8.set_quirks(profile);
+  chip8.set_clock(hz);
+  chip8.set_seed(SEED, stream);
+  chip8.mode = ExecutionMode::INTERPRETER;
+}
+
+/*
+ * A single instruction at 0x200 and its effect. setup is applied to the
+ * machine before the instruction runs. The expected state is the state after
+ * setup, with pc advanced by 2 and one cycle counted, and then changed by
+ * effect.
+ */
+struct OpcodeVector {
+  const char* name;
+  std::uint16_t opcode;
+  unsigned profiles; // bit N for the QuirkProfile with value N
+  std::function<void(CHIP8&)> setup;
+  std::function<void(CHIP8&)> effect;
+};
+
+constexpr unsigned ALL_PROFILES {0x7};
+
+unsigned only(QuirkProfile profile) {
+  return 1u << static_cast<unsigned>(profile);
+}
+
+const unsigned CHIP8_ONLY {only(QuirkProfile::CHIP8)};
+const unsigned CHIP48_ONLY {only(QuirkProfile::CHIP48)};
+const unsigned SUPER_CHIP_ONLY {only(QuirkProfile::SUPER_CHIP)};
+const unsigned CHIP48_AND_SUPER_CHIP {CHIP48_ONLY | SUPER_CHIP_ONLY};
+
+void nothing(CHIP8&) {}
+
+// A row of the display with the byte drawn at column 0.
+constexpr std::uint64_t at_col_0(std::uint8_t byte) {
+  return static_cast<std::uint64_t>(byte) << 56;
+}
+
+std::vector<OpcodeVector> opcode_vectors() {
+  return {
+    {"0NNN calls", 0x0345, ALL_PROFILES, nothing,
+     [](CHIP8& m) { m.stack[0] = 0x202; m.stack_pointer = 1; m.pc = 0x345; }},
+    {"00E0 clears the screen", 0x00E0, ALL_PROFILES,
+     [](CHIP8& m) { m.display[3] = ~0ull; m.display[31] = 1; },
+     [](CHIP8& m) { m.display.fill(0); m.dirty_rows = 0xFFFFFFFF; }},
+    {"00EE returns", 0x00EE, ALL_PROFILES,
+     [](CHIP8& m) { m.stack[0] = 0x345; m.stack_pointer = 1; },
+     [](CHIP8& m) { m.pc = 0x345; m.stack_pointer = 0; }},
+    {"00EE pops one level", 0x00EE, ALL_PROFILES,
+     [](CHIP8& m) {
+       m.stack[0] = 0x345; m.stack[1] = 0x456; m.stack_pointer = 2;
+     },
+     [](CHIP8& m) { m.pc = 0x456; m.stack_pointer = 1; }},
+    {"1NNN jumps", 0x1ABC, ALL_PROFILES, nothing,
+     [](CHIP8& m) { m.pc = 0xABC; }},
+    {"2NNN calls", 0x2ABC, ALL_PROFILES, nothing,
+     [](CHIP8& m) { m.stack[0] = 0x202; m.stack_pointer = 1; m.pc = 0xABC; }},
+    {"2NNN pushes onto the stack", 0x2ABC, ALL_PROFILES,
+     [](CHIP8& m) { m.stack[0] = 0x300; m.stack_pointer = 1; },
+     [](CHIP8& m) { m.stack[1] = 0x202; m.stack_pointer = 2; m.pc = 0xABC; }},
+    {"3XNN skips if equal", 0x3112, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x12; }, [](CHIP8& m) { m.pc = 0x204; }},
+    {"3XNN does not skip", 0x3112, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x13; }, nothing},
+    {"4XNN skips if not equal", 0x4112, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x13; }, [](CHIP8& m) { m.pc = 0x204; }},
+    {"4XNN does not skip", 0x4112, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x12; }, nothing},
+    {"5XY0 skips if equal", 0x5120, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x34; m.V[2] = 0x34; },
+     [](CHIP8& m) { m.pc = 0x204; }},
+    {"5XY0 does not skip", 0x5120, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x34; m.V[2] = 0x35; }, nothing},
+    {"6XNN loads", 0x61AB, ALL_PROFILES, nothing,
+     [](CHIP8& m) { m.V[1] = 0xAB; }},
+    {"7XNN wraps without touching VF", 0x7120, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0xF0; m.V[0xF] = 0x55; },
+     [](CHIP8& m) { m.V[1] = 0x10; }},
+    {"8XY0 copies", 0x8120, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x11; m.V[2] = 0x22; },
+     [](CHIP8& m) { m.V[1] = 0x22; }},
+    {"8XY1 ors", 0x8121, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x0C; m.V[2] = 0x0A; },
+     [](CHIP8& m) { m.V[1] = 0x0E; }},
+    {"8XY2 ands", 0x8122, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x0C; m.V[2] = 0x0A; },
+     [](CHIP8& m) { m.V[1] = 0x08; }},
+    {"8XY3 xors", 0x8123, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x0C; m.V[2] = 0x0A; },
+     [](CHIP8& m) { m.V[1] = 0x06; }},
+    {"8XY4 without carry", 0x8124, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x10; m.V[2] = 0x20; m.V[0xF] = 0x55; },
+     [](CHIP8& m) { m.V[1] = 0x30; m.V[0xF] = 0; }},
+    {"8XY4 with carry", 0x8124, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0xFF; m.V[2] = 0x01; },
+     [](CHIP8& m) { m.V[1] = 0x00; m.V[0xF] = 1; }},
+    {"8XY4 into VF keeps the carry", 0x8F24, ALL_PROFILES,
+     [](CHIP8& m) { m.V[0xF] = 0xFF; m.V[2] = 0x02; },
+     [](CHIP8& m) { m.V[0xF] = 1; }},
+    {"8XY4 from VF", 0x81F4, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x80; m.V[0xF] = 0x80; },
+     [](CHIP8& m) { m.V[1] = 0x00; m.V[0xF] = 1; }},
+    {"8XY5 without borrow", 0x8125, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x30; m.V[2] = 0x10; },
+     [](CHIP8& m) { m.V[1] = 0x20; m.V[0xF] = 1; }},
+    {"8XY5 of equal values", 0x8125, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x10; m.V[2] = 0x10; },
+     [](CHIP8& m) { m.V[1] = 0x00; m.V[0xF] = 1; }},
+    {"8XY5 with borrow", 0x8125, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x10; m.V[2] = 0x30; m.V[0xF] = 0x55; },
+     [](CHIP8& m) { m.V[1] = 0xE0; m.V[0xF] = 0; }},
+    {"8XY5 into VF keeps the borrow", 0x8F25, ALL_PROFILES,
+     [](CHIP8& m) { m.V[0xF] = 0x10; m.V[2] = 0x30; },
+     [](CHIP8& m) { m.V[0xF] = 0; }},
+    {"8XY6 shifts VY", 0x8126, CHIP8_ONLY,
+     [](CHIP8& m) { m.V[1] = 0xF0; m.V[2] = 0x05; },
+     [](CHIP8& m) { m.V[1] = 0x02; m.V[0xF] = 1; }},
+    {"8XY6 shifts VX", 0x8126, CHIP48_AND_SUPER_CHIP,
+     [](CHIP8& m) { m.V[1] = 0x04; m.V[2] = 0xFF; m.V[0xF] = 0x55; },
+     [](CHIP8& m) { m.V[1] = 0x02; m.V[0xF] = 0; }},
+    {"8XY6 into VF keeps the bit", 0x8F06, CHIP48_AND_SUPER_CHIP,
+     [](CHIP8& m) { m.V[0xF] = 0x03; }, [](CHIP8& m) { m.V[0xF] = 1; }},
+    {"8XY7 without borrow", 0x8127, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x10; m.V[2] = 0x30; },
+     [](CHIP8& m) { m.V[1] = 0x20; m.V[0xF] = 1; }},
+    {"8XY7 with borrow", 0x8127, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x30; m.V[2] = 0x10; m.V[0xF] = 0x55; },
+     [](CHIP8& m) { m.V[1] = 0xE0; m.V[0xF] = 0; }},
+    {"8XY7 into VF keeps the flag", 0x8F27, ALL_PROFILES,
+     [](CHIP8& m) { m.V[0xF] = 0x10; m.V[2] = 0x30; },
+     [](CHIP8& m) { m.V[0xF] = 1; }},
+    {"8XYE shifts VY", 0x812E, CHIP8_ONLY,
+     [](CHIP8& m) { m.V[1] = 0x0F; m.V[2] = 0x81; },
+     [](CHIP8& m) { m.V[1] = 0x02; m.V[0xF] = 1; }},
+    {"8XYE shifts VX", 0x812E, CHIP48_AND_SUPER_CHIP,
+     [](CHIP8& m) { m.V[1] = 0x40; m.V[2] = 0xFF; m.V[0xF] = 0x55; },
+     [](CHIP8& m) { m.V[1] = 0x80; m.V[0xF] = 0; }},
+    {"9XY0 skips if not equal", 0x9120, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x34; m.V[2] = 0x35; },
+     [](CHIP8& m) { m.pc = 0x204; }},
+    {"9XY0 does not skip", 0x9120, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x34; m.V[2] = 0x34; }, nothing},
+    {"ANNN loads I", 0xA123, ALL_PROFILES, nothing,
+     [](CHIP8& m) { m.I = 0x123; }},
+    {"BNNN adds V0", 0xB300, CHIP8_ONLY,
+     [](CHIP8& m) { m.V[0] = 0x10; m.V[3] = 0x20; },
+     [](CHIP8& m) { m.pc = 0x310; }},
+    {"BNNN adds VX", 0xB300, CHIP48_AND_SUPER_CHIP,
+     [](CHIP8& m) { m.V[0] = 0x10; m.V[3] = 0x20; },
+     [](CHIP8& m) { m.pc = 0x320; }},
+    // The first number drawn with the seed is 0x3DECD465.
+    {"CXNN draws from the seed", 0xC1FF, ALL_PROFILES, nothing,
+     [](CHIP8& m) { m.rng.next(); m.V[1] = 0x3D; }},
+    {"CXNN masks", 0xC10F, ALL_PROFILES, nothing,
+     [](CHIP8& m) { m.rng.next(); m.V[1] = 0x0D; }},
+    {"DXYN draws", 0xD125, ALL_PROFILES,
+     [](CHIP8& m) { m.I = 0; m.V[1] = 8; m.V[2] = 1; m.V[0xF] = 0x55; },
+     [](CHIP8& m) {
+       // The digit 0 of the fontset.
+       const std::uint8_t rows[] {0xF0, 0x90, 0x90, 0x90, 0xF0};
+       for (std::size_t row {0}; row < 5; ++row) {
+         m.display[1 + row] = at_col_0(rows[row]) >> 8;
+       }
+       m.V[0xF] = 0;
+       m.dirty_rows = 0x3E;
+     }},
+    {"DXYN collides", 0xD011, ALL_PROFILES,
+     [](CHIP8& m) {
+       m.I = 0x300; m.mem[0x300] = 0x3C; m.display[0] = at_col_0(0x81 | 0x0C);
+     },
+     [](CHIP8& m) {
+       m.display[0] = at_col_0(0x81 | 0x30); m.V[0xF] = 1; m.dirty_rows = 1;
+     }},
+    {"DXYN erases without colliding elsewhere", 0xD011, ALL_PROFILES,
+     [](CHIP8& m) {
+       m.I = 0x300; m.mem[0x300] = 0x0F; m.display[0] = at_col_0(0xF0);
+     },
+     [](CHIP8& m) {
+       m.display[0] = at_col_0(0xFF); m.V[0xF] = 0; m.dirty_rows = 1;
+     }},
+    {"DXYN wraps the position", 0xD121, ALL_PROFILES,
+     [](CHIP8& m) {
+       m.I = 0x300; m.mem[0x300] = 0x80; m.V[1] = 64 + 2; m.V[2] = 32 + 3;
+     },
+     [](CHIP8& m) {
+       m.display[3] = at_col_0(0x80) >> 2; m.V[0xF] = 0; m.dirty_rows = 1u << 3;
+     }},
+    {"DXYN wraps the sprite", 0xD122, CHIP8_ONLY,
+     [](CHIP8& m) {
+       m.I = 0x300; m.mem[0x300] = 0xFF; m.mem[0x301] = 0x81;
+       m.V[1] = 60; m.V[2] = 31;
+     },
+     [](CHIP8& m) {
+       m.display[31] = 0xF00000000000000Full;
+       m.display[0] = 0x1000000000000008ull;
+       m.V[0xF] = 0;
+       m.dirty_rows = 0x80000001;
+     }},
+    {"DXYN clips the sprite", 0xD122, CHIP48_AND_SUPER_CHIP,
+     [](CHIP8& m) {
+       m.I = 0x300; m.mem[0x300] = 0xFF; m.mem[0x301] = 0x81;
+       m.V[1] = 60; m.V[2] = 31;
+     },
+     [](CHIP8& m) {
+       m.display[31] = 0x0Full; m.V[0xF] = 0; m.dirty_rows = 0x80000000;
+     }},
+    {"EX9E skips if pressed", 0xE19E, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0xA; m.set_keypad(1u << 0xA); },
+     [](CHIP8& m) { m.pc = 0x204; }},
+    {"EX9E does not skip", 0xE19E, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0xA; m.set_keypad(1u << 0xB); }, nothing},
+    {"EXA1 skips if not pressed", 0xE1A1, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0xA; m.set_keypad(1u << 0xB); },
+     [](CHIP8& m) { m.pc = 0x204; }},
+    {"EXA1 does not skip", 0xE1A1, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0xA; m.set_keypad(1u << 0xA); }, nothing},
+    {"FX07 reads the delay timer", 0xF107, ALL_PROFILES,
+     [](CHIP8& m) { m.delay_timer = 0x42; }, [](CHIP8& m) { m.V[1] = 0x42; }},
+    {"FX0A waits for a key", 0xF10A, ALL_PROFILES, nothing,
+     [](CHIP8& m) { m.pc = 0x200; m.waiting_for_key = true; }},
+    {"FX0A ignores a key held before the wait", 0xF10A, ALL_PROFILES,
+     [](CHIP8& m) { m.set_keypad(1u << 4); },
+     [](CHIP8& m) {
+       m.pc = 0x200; m.waiting_for_key = true; m.wait_held_keys = 1u << 4;
+     }},
+    {"FX0A takes a new key", 0xF10A, ALL_PROFILES,
+     [](CHIP8& m) {
+       m.waiting_for_key = true; m.wait_held_keys = 1u << 4;
+       m.set_keypad(1u << 4 | 1u << 5 | 1u << 9);
+     },
+     [](CHIP8& m) { m.V[1] = 5; m.waiting_for_key = false; }},
+    {"FX15 sets the delay timer", 0xF115, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x42; }, [](CHIP8& m) { m.delay_timer = 0x42; }},
+    {"FX18 sets the sound timer", 0xF118, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0x42; }, [](CHIP8& m) { m.sound_timer = 0x42; }},
+    {"FX1E adds to I without touching VF", 0xF11E, ALL_PROFILES,
+     [](CHIP8& m) { m.I = 0xFFF; m.V[1] = 2; },
+     [](CHIP8& m) { m.I = 0x1001; }},
+    {"FX29 points I at a digit", 0xF129, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 0xA; }, [](CHIP8& m) { m.I = 50; }},
+    {"FX33 stores BCD", 0xF133, ALL_PROFILES,
+     [](CHIP8& m) { m.V[1] = 254; m.I = 0x300; },
+     [](CHIP8& m) {
+       m.mem[0x300] = 2; m.mem[0x301] = 5; m.mem[0x302] = 4;
+       m.memory_written(0x300, 3);
+     }},
+    {"FX55 stores and advances I past VX", 0xF255, CHIP8_ONLY,
+     [](CHIP8& m) { m.V[0] = 1; m.V[1] = 2; m.V[2] = 3; m.I = 0x300; },
+     [](CHIP8& m) {
+       m.mem[0x300] = 1; m.mem[0x301] = 2; m.mem[0x302] = 3;
+       m.memory_written(0x300, 3);
+       m.I = 0x303;
+     }},
+    {"FX55 stores and advances I to VX", 0xF255, CHIP48_ONLY,
+     [](CHIP8& m) { m.V[0] = 1; m.V[1] = 2; m.V[2] = 3; m.I = 0x300; },
+     [](CHIP8& m) {
+       m.mem[0x300] = 1; m.mem[0x301] = 2; m.mem[0x302] = 3;
+       m.memory_written(0x300, 3);
+       m.I = 0x302;
+     }},
+    {"FX55 stores and keeps I", 0xF255, SUPER_CHIP_ONLY,
+     [](CHIP8& m) { m.V[0] = 1; m.V[1] = 2; m.V[2] = 3; m.I = 0x300; },
+     [](CHIP8& m) {
+       m.mem[0x300] = 1; m.mem[0x301] = 2; m.mem[0x302] = 3;
+       m.memory_written(0x300, 3);
+     }},
+    {"FX65 loads and advances I past VX", 0xF265, CHIP8_ONLY,
+     [](CHIP8& m) {
+       m.mem[0x300] = 1; m.mem[0x301] = 2; m.mem[0x302] = 3; m.I = 0x300;
+     },
+     [](CHIP8& m) { m.V[0] = 1; m.V[1] = 2; m.V[2] = 3; m.I = 0x303; }},
+    {"FX65 loads and advances I to VX", 0xF265, CHIP48_ONLY,
+     [](CHIP8& m) {
+       m.mem[0x300] = 1; m.mem[0x301] = 2; m.mem[0x302] = 3; m.I = 0x300;
+     },
+     [](CHIP8& m) { m.V[0] = 1; m.V[1] = 2; m.V[2] = 3; m.I = 0x302; }},
+    {"FX65 loads and keeps I", 0xF265, SUPER_CHIP_ONLY,
+     [](CHIP8& m) {
+       m.mem[0x300] = 1; m.mem[0x301] = 2; m.mem[0x302] = 3; m.I = 0x300;
+     },
+     [](CHIP8& m) { m.V[0] = 1; m.V[1] = 2; m.V[2] = 3; }},
+    {"unknown operations are only counted", 0x5121, ALL_PROFILES, nothing,
+     [](CHIP8& m) { m.unknown_operations = 1; m.last_unknown_opcode = 0x5121; }}
+  };
+}
+
+// Ways of executing a single instruction.
+enum class Engine { REFERENCE, CLOCK_CYCLE, RUN, BLOCKS };
+
+const char* engine_name(Engine engine) {
+  switch (engine) {
+    case Engine::CLOCK_CYCLE: return "clock_cycle";
+    case Engine::RUN: return "run";
+    case Engine::BLOCKS: return "blocks";
+    case Engine::REFERENCE: break;
+  }
+  return "reference";
+}
+
+/**
+ * Checks the vector under the profile with each engine. Both machines come
+ * from the arena and are handed back afterwards.
+ */
+bool check_vector(MachineArena& arena, const OpcodeVector& vector,
+                  QuirkProfile profile) {
+  const std::uint8_t program[] {static_cast<std::uint8_t>(vector.opcode >> 8),
+                                static_cast<std::uint8_t>(vector.opcode)};
+  const RomImage rom {program, sizeof(program)};
+  bool passed {true};
+  for (Engine engine : {Engine::REFERENCE, Engine::CLOCK_CYCLE, Engine::RUN,
+                        Engine::BLOCKS}) {
+    CHIP8& actual {*arena.acquire(rom)};
+    CHIP8& expected {*arena.acquire(rom)};
+    configure(actual, profile, CHIP8::DEFAULT_CLOCK_HZ, 0);
+    configure(expected, profile, CHIP8::DEFAULT_CLOCK_HZ, 0);
+    vector.setup(actual);
+    vector.setup(expected);
+    switch (engine) {
+      case Engine::REFERENCE: reference_step(actual); break;
+      case Engine::CLOCK_CYCLE: actual.clock_cycle(); break;
+      case Engine::RUN: actual.run(1); break;
+      case Engine::BLOCKS:
+        actual.mode = ExecutionMode::BLOCKS;
+        actual.run(1);
+        break;
+    }
+    expected.pc += 2;
+    vector.effect(expected);
+    expected.tick(1);
+    std::ostringstream context {};
+    context << vector.name << " (" << quirk_profile_name(profile) << ", "
+            << engine_name(engine) << ')';
+    passed &= same_state(context.str(), expected, actual);
+    arena.release(&expected);
+    arena.release(&actual);
+  }
+  return passed;
+}
+
+/**
+ * Runs every vector under each profile it applies to, and makes sure that
+ * every handler any opcode decodes to under a profile is covered by at least
+ * one vector for that profile.
+ */
+bool test_opcodes() {
+  const std::vector<OpcodeVector> vectors {opcode_vectors()};
+  MachineArena arena {2};
+  bool passed {true};
+  for (QuirkProfile profile : PROFILES) {
+    std::set<Instruction::Handler> covered {};
+    for (const OpcodeVector& vector : vectors) {
+      if (vector.profiles & only(profile)) {
+        passed &= check_vector(arena, vector, profile);
+        covered.insert(CPU::decode(vector.opcode, profile).handler);
+      }
+    }
+    for (std::uint32_t opcode {0}; opcode <= 0xFFFF; ++opcode) {
+      const Instruction ins {
+        CPU::decode(static_cast<std::uint16_t>(opcode), profile)};
+      if (!covered.count(ins.handler)) {
+        std::cout << "No vector covers the handler of " << std::hex
+                  << std::uppercase << opcode << std::dec << " ("
+                  << quirk_profile_name(profile) << ")\n";
+        covered.insert(ins.handler);
+        passed = false;
+      }
+    }
+  }
+  return passed;
+}
+
+std::string source_path(const std::string& path) {
+  return std::string {CHIP8_SOURCE_DIR} + '/' + path;
+}
+
+// The screen of BC_test once every check passed: "BON" and the credits.
+const std::array<std::uint64_t, 32> BC_TEST_PASSED {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0x00000783C4200000, 0x0000044426200000, 0x0000044425200000,
+  0x0000078424A00000, 0x0000044424600000, 0x0000044424200000,
+  0x0000044424200000, 0x00000783C4200000,
+  0, 0, 0, 0, 0,
+  0x3000600087004000, 0x2800500084004000, 0x2940518CC4104600,
+  0x314062908428CA30, 0x29C0530884294C20, 0x2840520484294820,
+  0x304061986710C628, 0x01C0000000000000
+};
+
+// The screen of BC_test after error 12: 8XYE did not shift VX.
+const std::array<std::uint64_t, 32> BC_TEST_E12 {
+  0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0x00001FE000000000, 0x00001E0000000000, 0x00001E0008F00000,
+  0x00001FE018100000, 0x00001E0008F00000, 0x00001E0008800000,
+  0x00001E001CF00000, 0x00001FE000000000,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+// The screen of BC_test after error 16: FX65 did not read back what FX55
+// stored.
+const std::array<std::uint64_t, 32> BC_TEST_E16 {
+  0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0x00001FE000000000, 0x00001E0000000000, 0x00001E0008F00000,
+  0x00001FE018800000, 0x00001E0008F00000, 0x00001E0008900000,
+  0x00001E001CF00000, 0x00001FE000000000,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+/**
+ * BC_test stops in a jump to itself once it has shown its result. It was
+ * written for an interpreter whose 8XY6/8XYE shift VX and whose FX55/FX65
+ * leave I unchanged, which only the SUPER-CHIP profile follows: under chip8
+ * it stops on error 12 as 8XYE shifts VY, under chip48 on error 16 as FX55
+ * and FX65 advance I. Each profile has to stop on exactly that screen, so
+ * any other failure is caught.
+ */
+bool test_bc_test() {
+  constexpr std::size_t MAX_CYCLES {100000};
+  struct Outcome {
+    QuirkProfile profile;
+    const std::array<std::uint64_t, 32>& screen;
+    const char* shows;
+  };
+  const Outcome outcomes[] {
+    {QuirkProfile::CHIP8, BC_TEST_E12, "E 12"},
+    {QuirkProfile::CHIP48, BC_TEST_E16, "E 16"},
+    {QuirkProfile::SUPER_CHIP, BC_TEST_PASSED, "BON"}};
+  const RomImage rom {source_path("test/BC_test.ch8")};
+  bool passed {true};
+  for (const Outcome& outcome : outcomes) {
+    for (ExecutionMode mode : {ExecutionMode::INTERPRETER,
+                               ExecutionMode::BLOCKS}) {
+      CHIP8 chip8 {rom};
+      configure(chip8, outcome.profile, CHIP8::DEFAULT_CLOCK_HZ, 0);
+      chip8.mode = mode;
+      while (!chip8.halted() && chip8.cycles < MAX_CYCLES) {
+        chip8.run(100);
+      }
+      std::ostringstream context {};
+      context << "BC_test (" << quirk_profile_name(outcome.profile) << ", "
+              << (mode == ExecutionMode::BLOCKS ? "blocks" : "interpreter")
+              << ')';
+      if (!chip8.halted()) {
+        std::cout << context.str() << " did not finish\n";
+        passed = false;
+      }
+      if (chip8.display != outcome.screen) {
+        std::cout << context.str() << " should show " << outcome.shows
+                  << ", it shows:\n";
+        for (std::size_t row {0}; row < 32; ++row) {
+          for (std::size_t col {0}; col < 64; ++col) {
+            std::cout << (chip8.pixel(col, row) ? '#' : '.');
+          }
+          std::cout << '\n';
+        }
+        passed = false;
+      }
+    }
+  }
+  return passed;
+}
+
+// A named program for the differential tests.
+struct Program {
+  std::string name;
+  std::vector<std::uint8_t> bytes;
+};
+
+/**
+ * Random programs made of instructions that are valid under every profile,
+ * so that no run ends up reporting unknown operations. They jump, call,
+ * draw, wait for keys and overwrite their own code all over memory.
+ */
+std::vector<Program> random_programs(std::size_t count) {
+  Pcg32 rng {SEED, 1};
+  std::vector<Program> programs {};
+  for (std::size_t program_idx {0}; program_idx < count; ++program_idx) {
+    Program program {"random " + std::to_string(program_idx), {}};
+    while (program.bytes.size() < 0xE00) {
+      const std::uint16_t opcode {static_cast<std::uint16_t>(rng.next())};
+      bool valid {true};
+      for (QuirkProfile profile : PROFILES) {
+        valid &= CPU::decode(opcode, profile).handler != &CPU::op_unknown;
+      }
+      if (valid) {
+        program.bytes.push_back(static_cast<std::uint8_t>(opcode >> 8));
+        program.bytes.push_back(static_cast<std::uint8_t>(opcode));
+      }
+    }
+    programs.push_back(program);
+  }
+  return programs;
+}
+
+/**
+ * Straight-line programs that loop back to their start, made of the
+ * operations LockstepBatch executes for all lanes at once. CXNN gives each
+ * lane different values while the lanes stay at the same instruction.
+ */
+std::vector<Program> alu_programs(std::size_t count) {
+  // Each operation and the operand bits that may vary.
+  const std::uint16_t operations[][2] {
+    {0x6000, 0x0FFF}, {0x7000, 0x0FFF}, {0x8000, 0x0FF0}, {0x8001, 0x0FF0},
+    {0x8002, 0x0FF0}, {0x8003, 0x0FF0}, {0x8004, 0x0FF0}, {0x8005, 0x0FF0},
+    {0x8006, 0x0FF0}, {0x8007, 0x0FF0}, {0x800E, 0x0FF0}, {0x3000, 0x0FFF},
+    {0x4000, 0x0FFF}, {0x5000, 0x0FF0}, {0x9000, 0x0FF0}, {0xA000, 0x0FFF},
+    {0xF01E, 0x0F00}, {0xC000, 0x0FFF}};
+  const std::size_t operation_count {
+    sizeof(operations) / sizeof(operations[0])};
+  Pcg32 rng {SEED, 4};
+  std::vector<Program> programs {};
+  for (std::size_t program_idx {0}; program_idx < count; ++program_idx) {
+    Program program {"alu " + std::to_string(program_idx), {}};
+    while (program.bytes.size() < 0x3FE) {
+      const std::uint32_t draw {rng.next()};
+      const std::uint16_t* operation {operations[draw % operation_count]};
+      const std::uint16_t opcode {static_cast<std::uint16_t>(
+        operation[0] | ((draw >> 16) & operation[1]))};
+      program.bytes.push_back(static_cast<std::uint8_t>(opcode >> 8));
+      program.bytes.push_back(static_cast<std::uint8_t>(opcode));
+    }
+    program.bytes.push_back(0x12);
+    program.bytes.push_back(0x00);
+    programs.push_back(program);
+  }
+  return programs;
+}
+
+Program file_program(const std::string& path) {
+  const RomImage rom {source_path(path)};
+  return {path, std::vector<std::uint8_t>(rom.data(), rom.data() + rom.size())};
+}
+
+// The ROMs of the repository followed by generated programs.
+std::vector<Program> programs() {
+  std::vector<Program> all {file_program("roms/pong.ch8"),
+                            file_program("roms/tetris.ch8"),
+                            file_program("test/BC_test.ch8")};
+  // Writes 7201 or 7202 at 0x210, depending on a random number, and runs
+  // it. Machines with different random numbers end up at the same address
+  // with different code.
+  all.push_back({"random code", {0x60, 0x72, 0xC1, 0x01, 0x71, 0x01, 0xA2,
+                                 0x10, 0xF1, 0x55, 0x12, 0x10, 0x00, 0x00,
+                                 0x00, 0x00, 0x72, 0x01, 0x12, 0x00}});
+  for (Program& program : random_programs(16)) {
+    all.push_back(program);
+  }
+  for (Program& program : alu_programs(4)) {
+    all.push_back(program);
+  }
+  return all;
+}
+
+/*
+ * Splits a run into chunks of random length and changes the keypad between
+ * them, the same way for every machine of a comparison.
+ */
+class Schedule {
+public:
+  explicit Schedule(std::uint64_t stream) : rng {SEED, stream} {}
+
+  std::size_t chunk() {
+    return 1 + rng.next() % 700;
+  }
+
+  std::uint16_t keypad() {
+    // Mostly no keys or a single one, now and then several.
+    const std::uint32_t draw {rng.next()};
+    switch (draw % 4) {
+      case 0: return 0;
+      case 1: return static_cast<std::uint16_t>(draw >> 16);
+      default: return static_cast<std::uint16_t>(1u << ((draw >> 8) & 0xF));
+    }
+  }
+
+private:
+  Pcg32 rng;
+};
+
+// Prepares a machine before a differential run, e.g. by warming it up.
+using Prepare = std::function<void(CHIP8&)>;
+
+/**
+ * Runs the program for the given number of cycles on the reference
+ * interpreter and through run() on a machine set up by prepare, comparing
+ * them after every chunk of the schedule. Stops at the first difference.
+ */
+bool matches_reference(const Program& program, QuirkProfile profile,
+                       std::uint32_t hz, const std::string& engine,
+                       const Prepare& prepare, std::uint64_t cycles) {
+  const RomImage rom {program.bytes.data(), program.bytes.size()};
+  MachineArena arena {2};
+  CHIP8& reference {*arena.acquire(rom)};
+  CHIP8& actual {*arena.acquire(rom)};
+  configure(reference, profile, hz, 0);
+  configure(actual, profile, hz, 0);
+  prepare(actual);
+  Schedule schedule {2};
+  while (reference.cycles < cycles) {
+    const std::uint16_t keys {schedule.keypad()};
+    reference.set_keypad(keys);
+    actual.set_keypad(keys);
+    const std::size_t chunk {schedule.chunk()};
+    for (std::size_t step {0}; step < chunk; ++step) {
+      reference_step(reference);
+    }
+    actual.run(chunk);
+    std::ostringstream context {};
+    context << program.name << " (" << quirk_profile_name(profile) << ", " << hz
+            << " Hz, " << engine << ", cycle " << reference.cycles << ')';
+    if (!same_state(context.str(), reference, actual)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void warm_up(CHIP8& chip8) {
+  Analysis {chip8}.warm_up(chip8);
+}
+
+void use_blocks(CHIP8& chip8) {
+  chip8.mode = ExecutionMode::BLOCKS;
+}
+
+bool test_predecoder() {
+  bool passed {true};
+  for (const Program& program : programs()) {
+    for (QuirkProfile profile : PROFILES) {
+      passed &= matches_reference(program, profile, CHIP8::DEFAULT_CLOCK_HZ,
+                                  "cold", nothing, 200000);
+      passed &= matches_reference(program, profile, CHIP8::DEFAULT_CLOCK_HZ,
+                                  "warm", warm_up, 200000);
+    }
+  }
+  return passed;
+}
+
+bool test_blocks() {
+  const Prepare warm_blocks {[](CHIP8& chip8) {
+    use_blocks(chip8);
+    warm_up(chip8);
+  }};
+  bool passed {true};
+  for (const Program& program : programs()) {
+    for (QuirkProfile profile : PROFILES) {
+      passed &= matches_reference(program, profile, CHIP8::DEFAULT_CLOCK_HZ,
+                                  "blocks cold", use_blocks, 200000);
+      passed &= matches_reference(program, profile, CHIP8::DEFAULT_CLOCK_HZ,
+                                  "blocks warm", warm_blocks, 200000);
+    }
+  }
+  return passed;
+}
+
+/**
+ * Gives every lane its own random number stream, and half of the lanes a
+ * different keypad, so that the lanes split up and join again.
+ */
+template <std::size_t Lanes>
+bool lanes_match_reference(const Program& program, QuirkProfile profile,
+                           std::uint64_t cycles) {
+  const RomImage rom {program.bytes.data(), program.bytes.size()};
+  LockstepBatch<Lanes> batch {rom};
+  MachineArena arena {Lanes};
+  std::array<CHIP8*, Lanes> reference {};
+  for (std::size_t lane {0}; lane < Lanes; ++lane) {
+    reference[lane] = arena.acquire(rom);
+    configure(*reference[lane], profile, CHIP8::DEFAULT_CLOCK_HZ, lane);
+    configure(batch.lane(lane), profile, CHIP8::DEFAULT_CLOCK_HZ, lane);
+  }
+  Schedule schedule {3};
+  while (reference[0]->cycles < cycles) {
+    const std::uint16_t keys {schedule.keypad()};
+    const std::size_t chunk {schedule.chunk()};
+    for (std::size_t lane {0}; lane < Lanes; ++lane) {
+      const std::uint16_t lane_keys {
+        static_cast<std::uint16_t>(lane % 2 ? keys : keys >> 1)};
+      reference[lane]->set_keypad(lane_keys);
+      batch.lane(lane).set_keypad(lane_keys);
+      for (std::size_t step {0}; step < chunk; ++step) {
+        reference_step(*reference[lane]);
+      }
+    }
+    batch.run(chunk);
+    for (std::size_t lane {0}; lane < Lanes; ++lane) {
+      std::ostringstream context {};
+      context << program.name << " (" << quirk_profile_name(profile)
+              << ", lane " << lane << " of " << Lanes << ", cycle "
+              << reference[lane]->cycles << ')';
+      if (!same_state(context.str(), *reference[lane], batch.lane(lane))) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool test_lanes() {
+  bool passed {true};
+  for (const Program& program : programs()) {
+    for (QuirkProfile profile : PROFILES) {
+      passed &= lanes_match_reference<8>(program, profile, 50000);
+      passed &= lanes_match_reference<16>(program, profile, 20000);
+      passed &= lanes_match_reference<32>(program, profile, 10000);
+    }
+  }
+  return passed;
+}
+
+// Programs built around each kind of idle loop.
+std::vector<Program> idle_programs() {
+  return {
+    {"jump to self", {0x60, 0x30, 0xF0, 0x15, 0xF0, 0x18, 0x12, 0x06}},
+    {"key poll", {0x60, 0x05, 0xE0, 0x9E, 0x12, 0x02, 0x71, 0x01, 0xE0, 0xA1,
+                  0x12, 0x08, 0x72, 0x01, 0x12, 0x02}},
+    {"key wait", {0xF0, 0x0A, 0x71, 0x01, 0x12, 0x00}},
+    {"timer wait", {0x60, 0x20, 0xF0, 0x15, 0xF1, 0x07, 0x31, 0x05, 0x12, 0x04,
+                    0x72, 0x01, 0xF0, 0x15, 0xF1, 0x07, 0x31, 0x00, 0x12, 0x0E,
+                    0x12, 0x00}},
+    {"missed timer wait", {0x60, 0x20, 0xF0, 0x15, 0xF1, 0x07, 0x31, 0x40,
+                           0x12, 0x04}}
+  };
+}
+
+/**
+ * Runs the idle loops at clock rates that make the timers count down every
+ * cycle, every few cycles and rarely.
+ */
+bool test_idle() {
+  bool passed {true};
+  for (const Program& program : idle_programs()) {
+    for (std::uint32_t hz : {60u, 120u, 180u, 600u, 5000u}) {
+      passed &= matches_reference(program, QuirkProfile::CHIP8, hz, "run",
+                                  nothing, 100000);
+      passed &= matches_reference(program, QuirkProfile::CHIP8, hz,
+                                  "blocks", use_blocks, 100000);
+    }
+  }
+  return passed;
+}
+
+/**
+ * A profiled run has to record every cycle it executes, idle loops included,
+ * and end in the same state as a run without profiler, even in BLOCKS mode.
+ */
+bool test_profiler() {
+  constexpr std::size_t CYCLES {600000};
+  std::vector<Program> profiled {file_program("roms/pong.ch8"),
+                                 file_program("roms/tetris.ch8")};
+  for (Program& program : idle_programs()) {
+    profiled.push_back(program);
+  }
+  bool passed {true};
+  for (const Program& program : profiled) {
+    const RomImage rom {program.bytes.data(), program.bytes.size()};
+    MachineArena arena {2};
+    CHIP8& plain {*arena.acquire(rom)};
+    CHIP8& actual {*arena.acquire(rom)};
+    configure(plain, QuirkProfile::CHIP8, CHIP8::DEFAULT_CLOCK_HZ, 0);
+    configure(actual, QuirkProfile::CHIP8, CHIP8::DEFAULT_CLOCK_HZ, 0);
+    actual.mode = ExecutionMode::BLOCKS;
+    Profiler profiler {};
+    plain.run(CYCLES);
+    actual.run(CYCLES, profiler);
+    if (profiler.instruction_count() != actual.cycles
+        || actual.idle_cycles != 0) {
+      std::cout << program.name << ": profiled "
+                << profiler.instruction_count() << " of " << actual.cycles
+                << " cycles, " << actual.idle_cycles << " skipped\n";
+      passed = false;
+    }
+    passed &= same_state(program.name + " (profiled)", plain, actual);
+  }
+  return passed;
+}
+
+/**
+ * A program that only ever writes to page 8 of memory must share every other
+ * page between consecutive snapshots, and restoring a snapshot, directly or
+ * after serializing it, has to resume the run where it was taken.
+ */
+bool test_snapshot() {
+  constexpr std::size_t CYCLES {100};
+  // 0x202: V0 += 1, I = 0x800, store V0 at I, jump back to 0x202.
+  const std::vector<std::uint8_t> program {
+    0x60, 0x00, 0x70, 0x01, 0xA8, 0x00, 0xF0, 0x55, 0x12, 0x02};
+  const RomImage rom {program.data(), program.size()};
+  MachineArena arena {3};
+  CHIP8& actual {*arena.acquire(rom)};
+  CHIP8& straight {*arena.acquire(rom)};
+  CHIP8& deserialized {*arena.acquire(rom)};
+  for (CHIP8* chip8 : {&actual, &straight, &deserialized}) {
+    configure(*chip8, QuirkProfile::CHIP8, CHIP8::DEFAULT_CLOCK_HZ, 0);
+  }
+  bool passed {true};
+  actual.run(CYCLES);
+  const Snapshot first {actual.snapshot()};
+  const std::array<std::uint8_t, 4096> first_mem {actual.mem};
+  actual.run(CYCLES);
+  const Snapshot second {actual.snapshot()};
+  for (std::size_t page {0}; page < Snapshot::PAGE_COUNT; ++page) {
+    if ((first.pages[page] == second.pages[page]) != (page != 8)) {
+      std::cout << "page " << page << " is "
+                << (page != 8 ? "copied although unchanged"
+                              : "shared although written") << '\n';
+      passed = false;
+    }
+  }
+  if (!std::equal(first.pages[8]->begin(), first.pages[8]->end(),
+                  first_mem.begin() + 8 * Snapshot::PAGE_SIZE)) {
+    std::cout << "a later write changed the first snapshot\n";
+    passed = false;
+  }
+  // Restoring resets the dirty pages and marks every row dirty, which the
+  // straight run gets from a snapshot and a frame of its own.
+  actual.restore(first);
+  actual.take_changed_rows();
+  straight.run(CYCLES);
+  straight.snapshot();
+  straight.take_changed_rows();
+  passed &= same_state("restored", straight, actual);
+  actual.run(CYCLES);
+  straight.run(CYCLES);
+  passed &= same_state("run after restore", straight, actual);
+  actual.snapshot();
+  deserialized.restore(Snapshot::deserialize(second.serialize()));
+  deserialized.take_changed_rows();
+  passed &= same_state("deserialized", actual, deserialized);
+  return passed;
+}
+
+/**
+ * Replaying an input log on a machine seeded and clocked differently has to
+ * reproduce the recorded run, and a reset afterwards has to start over from
+ * the recorded seed. A machine that already ran cannot be recorded.
+ */
+bool test_replay() {
+  constexpr std::size_t CHUNK {997};
+  const Program program {file_program("roms/pong.ch8")};
+  const RomImage rom {program.bytes.data(), program.bytes.size()};
+  MachineArena arena {2};
+  CHIP8& recorded {*arena.acquire(rom)};
+  CHIP8& replayed {*arena.acquire(rom)};
+  configure(recorded, QuirkProfile::CHIP8, CHIP8::DEFAULT_CLOCK_HZ, 0);
+  configure(replayed, QuirkProfile::CHIP8, 1000, 5);
+  replayed.set_seed(SEED + 1, 5);
+  std::stringstream log {};
+  {
+    InputRecorder recorder {log, recorded, rom};
+    for (std::size_t step {0}; step < 60; ++step) {
+      recorded.run(CHUNK);
+      recorded.set_keypad(
+        static_cast<std::uint16_t>(step % 3 ? 1u << (step % 16) : 0));
+      recorder.record(recorded);
+    }
+  }
+  recorded.run(CHUNK);
+  bool passed {true};
+  InputReplayer replayer {log};
+  replayer.prepare(replayed, rom);
+  while (replayer.step(replayed)) {
+  }
+  replayed.run(recorded.cycles - replayed.cycles);
+  if (replayer.desynced()) {
+    std::cout << "the replay reports a desync\n";
+    passed = false;
+  }
+  passed &= same_state("replayed", recorded, replayed);
+  recorded.reset(rom);
+  replayed.reset(rom);
+  recorded.run(CHUNK);
+  replayed.run(CHUNK);
+  passed &= same_state("reset after replay", recorded, replayed);
+  try {
+    std::ostringstream late {};
+    InputRecorder recorder {late, recorded, rom};
+    std::cout << "recording started on a machine that already ran\n";
+    passed = false;
+  } catch (const std::invalid_argument&) {
+  }
+  return passed;
+}
+
+/**
+ * Every frame captured has to decode to the display and cycle it was taken
+ * at, and a capture cut short has to be rejected rather than misread.
+ */
+bool test_capture() {
+  constexpr std::size_t FRAMES {600};
+  const Program program {file_program("roms/pong.ch8")};
+  const RomImage rom {program.bytes.data(), program.bytes.size()};
+  MachineArena arena {1};
+  CHIP8& chip8 {*arena.acquire(rom)};
+  configure(chip8, QuirkProfile::CHIP8, CHIP8::DEFAULT_CLOCK_HZ, 0);
+  std::vector<std::pair<std::uint64_t, std::array<std::uint64_t, 32>>>
+    expected {};
+  std::stringstream capture {};
+  bool passed {true};
+  {
+    FrameRecorder recorder {capture, chip8, true};
+    for (std::size_t frame {0}; frame < FRAMES; ++frame) {
+      chip8.run(chip8.tick_countdown);
+      const std::uint32_t changed_rows {chip8.take_changed_rows()};
+      if (changed_rows) {
+        expected.emplace_back(chip8.cycles, chip8.display);
+      }
+      recorder.capture(chip8, changed_rows);
+    }
+    if (recorder.dropped()) {
+      std::cout << "a lossless capture dropped frames\n";
+      passed = false;
+    }
+  }
+  FrameReader reader {capture};
+  if (reader.cycles_per_tick() != chip8.cycles_per_tick) {
+    std::cout << "cycles_per_tick differs\n";
+    passed = false;
+  }
+  for (std::size_t frame {0}; frame < expected.size(); ++frame) {
+    if (!reader.next() || reader.cycle() != expected[frame].first
+        || reader.display() != expected[frame].second) {
+      std::cout << "frame " << frame << " of " << expected.size()
+                << " does not decode to what was captured\n";
+      return false;
+    }
+  }
+  if (expected.empty() || reader.next()) {
+    std::cout << "the capture holds " << expected.size()
+              << " frames or more than captured\n";
+    passed = false;
+  }
+  std::string truncated {capture.str()};
+  truncated.pop_back();
+  std::istringstream in {truncated};
+  try {
+    FrameReader cut {in};
+    while (cut.next()) {
+    }
+    std::cout << "a truncated capture was accepted\n";
+    passed = false;
+  } catch (const std::invalid_argument&) {
+  }
+  return passed;
+}
+
+/**
+ * The analysis has to report exactly the problems each program has, and the
+ * listing has to describe BNNN the way the quirk profile executes it.
+ */
+bool test_analyzer() {
+  struct Case {
+    const char* name;
+    std::vector<std::uint8_t> bytes;
+    std::vector<std::string> problems;
+  };
+  std::vector<Case> cases {
+    {"sound", {0x60, 0x01, 0x12, 0x02}, {}},
+    {"unknown opcode", {0x60, 0x01, 0x51, 0x21},
+     {"Unknown opcode 5121 at 202."}},
+    {"jump out of the program", {0x10, 0x00},
+     {"Control leaves the program area at 200 towards 000."}},
+    {"no end", {}, {"Execution runs past the end of memory at FFE."}}};
+  for (std::size_t idx {0}; idx < 0x700; ++idx) {
+    cases.back().bytes.push_back(0x60);
+    cases.back().bytes.push_back(0x00);
+  }
+  MachineArena arena {1};
+  bool passed {true};
+  for (const Case& test_case : cases) {
+    const RomImage rom {test_case.bytes.data(), test_case.bytes.size()};
+    CHIP8& chip8 {*arena.acquire(rom)};
+    const Analysis analysis {chip8};
+    if (analysis.problems != test_case.problems) {
+      std::cout << test_case.name << ": reported";
+      for (const std::string& problem : analysis.problems) {
+        std::cout << " \"" << problem << '"';
+      }
+      std::cout << '\n';
+      passed = false;
+    }
+    arena.release(&chip8);
+  }
+  const std::uint8_t jump[] {0xB3, 0x00};
+  const RomImage rom {jump, sizeof(jump)};
+  for (QuirkProfile profile : PROFILES) {
+    CHIP8& chip8 {*arena.acquire(rom)};
+    chip8.set_quirks(profile);
+    const Analysis analysis {chip8};
+    std::ostringstream listing {};
+    analysis.write_listing(chip8, listing);
+    const std::string target {profile == QuirkProfile::CHIP8
+                              ? "Jump to address 300 + V0"
+                              : "Jump to address 300 + V3"};
+    if (listing.str().find(target) == std::string::npos
+        || analysis.indirect_jumps != std::vector<std::uint16_t> {0x200}) {
+      std::cout << "BNNN (" << quirk_profile_name(profile) << "): "
+                << listing.str();
+      passed = false;
+    }
+    arena.release(&chip8);
+  }
+  return passed;
+}
+
+/**
+ * A machine driven through the C interface has to run exactly like one
+ * driven directly, snapshots have to survive serialization, and failures
+ * have to come back as error values.
+ */
+bool test_c_abi() {
+  constexpr std::uint64_t CHUNK {10000};
+  const Program program {file_program("roms/pong.ch8")};
+  const RomImage rom {program.bytes.data(), program.bytes.size()};
+  MachineArena arena {1};
+  CHIP8& expected {*arena.acquire(rom)};
+  configure(expected, QuirkProfile::CHIP48, CHIP8::DEFAULT_CLOCK_HZ, 0);
+  chip8_machine* machine {
+    chip8_create(program.bytes.data(), program.bytes.size())};
+  if (!machine) {
+    std::cout << chip8_last_error() << '\n';
+    return false;
+  }
+  bool passed {true};
+  chip8_set_clock(machine, CHIP8::DEFAULT_CLOCK_HZ);
+  chip8_set_seed(machine, SEED, 0);
+  if (chip8_set_quirks(machine, CHIP8_QUIRKS_CHIP48) != 0) {
+    std::cout << chip8_last_error() << '\n';
+    passed = false;
+  }
+  const auto same_run = [&](const char* context, std::uint64_t cycles) {
+    if (cycles != expected.cycles
+        || !std::equal(expected.display.begin(), expected.display.end(),
+                       chip8_framebuffer(machine))
+        || (chip8_halted(machine) != 0) != expected.halted()
+        || (chip8_sound_active(machine) != 0) != (expected.sound_timer != 0)) {
+      std::cout << context << ": differs at cycle " << expected.cycles
+                << '\n';
+      return false;
+    }
+    return true;
+  };
+  for (std::uint16_t step {0}; step < 10; ++step) {
+    const std::uint16_t keys {static_cast<std::uint16_t>(1u << step)};
+    chip8_set_keypad(machine, keys);
+    expected.set_keypad(keys);
+    expected.run(CHUNK);
+    passed &= same_run("run", chip8_run_cycles(machine, CHUNK));
+  }
+  chip8_snapshot* snapshot {chip8_snapshot_take(machine)};
+  const std::size_t size {chip8_snapshot_serialize(snapshot, nullptr, 0)};
+  std::vector<std::uint8_t> data(size);
+  if (chip8_snapshot_serialize(snapshot, data.data(), data.size()) != size) {
+    std::cout << "the serialized size changed\n";
+    passed = false;
+  }
+  chip8_snapshot_free(snapshot);
+  expected.run(CHUNK);
+  passed &= same_run("before restore", chip8_run_cycles(machine, CHUNK));
+  chip8_snapshot* restored {
+    chip8_snapshot_deserialize(data.data(), data.size())};
+  if (!restored || chip8_snapshot_restore(machine, restored) != 0) {
+    std::cout << chip8_last_error() << '\n';
+    passed = false;
+  }
+  chip8_snapshot_free(restored);
+  passed &= same_run("after restore", chip8_run_cycles(machine, CHUNK));
+  const std::vector<std::uint8_t> too_large(0xE01);
+  if (chip8_create(too_large.data(), too_large.size())
+      || chip8_set_quirks(machine, 3) != -1
+      || chip8_snapshot_deserialize(data.data(), 3)
+      || chip8_last_error()[0] == '\0') {
+    std::cout << "an invalid call succeeded\n";
+    passed = false;
+  }
+  chip8_destroy(machine);
+  return passed;
+}
+
+/**
+ * A machine handed back to the arena and acquired again with another ROM has
+ * to be indistinguishable from a fresh one with the same configuration,
+ * without the arena growing.
+ */
+bool test_arena() {
+  constexpr std::size_t CYCLES {50000};
+  const Program pong {file_program("roms/pong.ch8")};
+  const Program tetris {file_program("roms/tetris.ch8")};
+  const RomImage pong_rom {pong.bytes.data(), pong.bytes.size()};
+  const RomImage tetris_rom {tetris.bytes.data(), tetris.bytes.size()};
+  MachineArena arena {2};
+  bool passed {true};
+  CHIP8* used {arena.acquire(pong_rom)};
+  configure(*used, QuirkProfile::SUPER_CHIP, 1000, 3);
+  used->mode = ExecutionMode::BLOCKS;
+  used->set_keypad(0x10);
+  used->run(CYCLES);
+  arena.release(used);
+  CHIP8* recycled {arena.acquire(tetris_rom)};
+  CHIP8* fresh {arena.acquire(tetris_rom)};
+  configure(*fresh, QuirkProfile::SUPER_CHIP, 1000, 3);
+  fresh->mode = ExecutionMode::BLOCKS;
+  if (recycled != used || arena.in_use() != 2
+      || recycled->mode != ExecutionMode::BLOCKS) {
+    std::cout << "the released machine was not reused as configured\n";
+    passed = false;
+  }
+  passed &= same_state("recycled", *fresh, *recycled);
+  fresh->run(CYCLES);
+  recycled->run(CYCLES);
+  passed &= same_state("run after recycling", *fresh, *recycled);
+  try {
+    arena.acquire(pong_rom);
+    std::cout << "a full arena handed out a machine\n";
+    passed = false;
+  } catch (const std::runtime_error&) {
+  }
+  return passed;
+}
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const std::map<std::string, bool (*)()> tests {
+    {"opcodes", &test_opcodes}, {"bc_test", &test_bc_test},
+    {"predecoder", &test_predecoder}, {"blocks", &test_blocks},
+    {"lanes", &test_lanes}, {"idle", &test_idle},
+    {"profiler", &test_profiler}, {"snapshot", &test_snapshot},
+    {"replay", &test_replay}, {"capture", &test_capture},
+    {"analyzer", &test_analyzer}, {"c_abi", &test_c_abi},
+    {"arena", &test_arena}};
+  const auto test {argc == 2 ? tests.find(argv[1]) : tests.end()};
+  if (test == tests.end()) {
+    std::cerr << "Usage: " << argv[0] << " <test>\nTests:";
+    for (const auto& entry : tests) {
+      std::cerr << ' ' << entry.first;
+    }
+    std::cerr << '\n';
+    return 2;
+  }
+  try {
+    return test->second() ? 0 : 1;
+  } catch (const std::exception& e) {
+    std::cout << e.what() << '\n';
+    return 1;
+  }
+}